@@ -1,6 +1,11 @@
 ﻿#include "Application.h"
 
 #include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
 
 #include <GL/glew.h>
 #include <GL/glut.h>
@@ -9,6 +14,13 @@
 #include "Camera.h"
 #include "ScenePrimitives.h"
 #include "LevelController.h"
+#include "GpuProfiler.h"
+#include "Profiler.h"
+#include "OffscreenContext.h"
+#include "Benchmark.h"
+#include "PortalBenchmark.h"
+#include "BroadphaseBenchmark.h"
+#include "PhysicsSelfCheck.h"
 
 using namespace portal;
 
@@ -18,6 +30,7 @@ namespace
 	constexpr int DEFAULT_WIDTH = 2560;
 	constexpr int DEFAULT_HEIGHT = 1440;
 	constexpr unsigned int UPDATE_TIME = 17; // 游戏逻辑每秒更新60次, 16.66666ms间隔
+	constexpr int DEFAULT_OFFSCREEN_FRAMES = 600;
 }
 
 ///
@@ -76,6 +89,20 @@ Application::GLUTUpdateCallback( int /*value*/ )
 	glutTimerFunc( UPDATE_TIME, GLUTUpdateCallback, 1 );
 }
 
+///
+/// 基准测试和回放不限制帧率，每次空闲都更新并渲染一帧
+/// 
+/*static*/
+void
+Application::GLUTUncappedIdleCallback()
+{
+	if( sInstance )
+	{
+		sInstance->Update();
+	}
+	glutPostRedisplay();
+}
+
 /*static*/
 void 
 Application::GLUTMouseMoveCallback( int x, int y )
@@ -120,6 +147,7 @@ Application::Application( Params params )
 	: mParams( params )
 	, mWindowWidth( DEFAULT_WIDTH )
 	, mWindowHeight( DEFAULT_HEIGHT )
+	, mTick( 0 )
 {
 	mKeyStatus.emplace( 'w', false );
 	mKeyStatus.emplace( 'a', false );
@@ -127,23 +155,282 @@ Application::Application( Params params )
 	mKeyStatus.emplace( 'd', false );
 	mKeyStatus.emplace( ' ', false );
 	mKeyStatus.emplace( 'e', false );
+	mKeyStatus.emplace( 'r', false );
 
 	mMouseButtonState.emplace( 1, false );
 	mMouseButtonState.emplace( 2, false );
 	mMouseButtonState.emplace( 3, false );
+
+	ParseCommandLine();
+}
+
+void
+Application::ParseCommandLine()
+{
+	for( int i = 1; i < mParams.argc; i++ )
+	{
+		const char* arg = mParams.argv[i];
+		if( std::strcmp( arg, "--gpu-profile" ) == 0 && i + 1 < mParams.argc )
+		{
+			mOptions.gpu_profile_path = mParams.argv[++i];
+		}
+		else if( std::strcmp( arg, "--trace" ) == 0 && i + 1 < mParams.argc )
+		{
+			mOptions.trace_path = mParams.argv[++i];
+		}
+		else if( std::strcmp( arg, "--offscreen" ) == 0 )
+		{
+			mOptions.offscreen = true;
+		}
+		else if( std::strcmp( arg, "--headless" ) == 0 )
+		{
+			mOptions.headless = true;
+		}
+		else if( std::strcmp( arg, "--size" ) == 0 && i + 1 < mParams.argc )
+		{
+			int width = 0;
+			int height = 0;
+			if( std::sscanf( mParams.argv[++i], "%dx%d", &width, &height ) == 2 && width > 0 && height > 0 )
+			{
+				mWindowWidth = width;
+				mWindowHeight = height;
+			}
+			else
+			{
+				std::cerr << "ERROR: Invalid --size " << mParams.argv[i] << ", expected WIDTHxHEIGHT" << std::endl;
+			}
+		}
+		else if( std::strcmp( arg, "--frames" ) == 0 && i + 1 < mParams.argc )
+		{
+			mOptions.frames = std::max( std::atoi( mParams.argv[++i] ), 0 );
+		}
+		else if( std::strcmp( arg, "--screenshot" ) == 0 && i + 1 < mParams.argc )
+		{
+			mOptions.screenshot_path = mParams.argv[++i];
+		}
+		else if( std::strcmp( arg, "--benchmark" ) == 0 && i + 1 < mParams.argc )
+		{
+			mOptions.benchmark_path = mParams.argv[++i];
+		}
+		else if( std::strcmp( arg, "--benchmark-output" ) == 0 && i + 1 < mParams.argc )
+		{
+			mOptions.benchmark_output = mParams.argv[++i];
+		}
+		else if( std::strcmp( arg, "--bench-portals" ) == 0 && i + 2 < mParams.argc )
+		{
+			mOptions.bench_portal_pairs = mParams.argv[++i];
+			mOptions.bench_portal_objects = mParams.argv[++i];
+		}
+		else if( std::strcmp( arg, "--bench-broadphases" ) == 0 && i + 1 < mParams.argc )
+		{
+			mOptions.bench_broadphase_boxes = std::max( std::atoi( mParams.argv[++i] ), 0 );
+		}
+		else if( std::strcmp( arg, "--self-check" ) == 0 )
+		{
+			mOptions.self_check = true;
+		}
+		else if( std::strcmp( arg, "--uncapped-render" ) == 0 )
+		{
+			mOptions.uncapped_render = true;
+		}
+		else if( std::strcmp( arg, "--physics-threads" ) == 0 && i + 1 < mParams.argc )
+		{
+			mOptions.physics_threads = std::max( std::atoi( mParams.argv[++i] ), 0 );
+		}
+		else if( std::strcmp( arg, "--physics-stress" ) == 0 && i + 1 < mParams.argc )
+		{
+			mOptions.physics_stress = std::max( std::atoi( mParams.argv[++i] ), 0 );
+		}
+		else if( std::strcmp( arg, "--broadphase" ) == 0 && i + 1 < mParams.argc )
+		{
+			mOptions.broadphase = mParams.argv[++i];
+		}
+		else if( std::strcmp( arg, "--box-pool" ) == 0 && i + 1 < mParams.argc )
+		{
+			mOptions.box_pool = std::max( std::atoi( mParams.argv[++i] ), 1 );
+		}
+		else if( std::strcmp( arg, "--bake-walls" ) == 0 )
+		{
+			mOptions.bake_walls = true;
+		}
+		else if( std::strcmp( arg, "--record" ) == 0 && i + 1 < mParams.argc )
+		{
+			mOptions.record_path = mParams.argv[++i];
+		}
+		else if( std::strcmp( arg, "--replay" ) == 0 && i + 1 < mParams.argc )
+		{
+			mOptions.replay_path = mParams.argv[++i];
+		}
+	}
 }
 
 bool
 Application::Initialize()
+{
+	profiler::SetThreadName( "Main" );
+	profiler::SetEnabled( !mOptions.trace_path.empty() );
+	if( mOptions.self_check )
+	{
+		// 自检自己建物理世界，Run()里执行
+		return true;
+	}
+
+	std::string level_path = "resources/levels/level_intro.json";
+	if( !mOptions.benchmark_path.empty() )
+	{
+		mBenchmark = std::make_unique<Benchmark>();
+		if( !mBenchmark->LoadScript( mOptions.benchmark_path ) )
+		{
+			return false;
+		}
+		level_path = mBenchmark->GetLevelPath();
+	}
+	if( !mOptions.replay_path.empty() )
+	{
+		if( mBenchmark || !mOptions.record_path.empty() )
+		{
+			std::cerr << "ERROR: --replay can not be combined with --benchmark or --record" << std::endl;
+			return false;
+		}
+		mInputReplay = std::make_unique<InputReplay>();
+		if( !mInputReplay->Load( mOptions.replay_path, UPDATE_TIME ) )
+		{
+			return false;
+		}
+	}
+	else if( !mOptions.record_path.empty() )
+	{
+		mInputRecorder = std::make_unique<InputRecorder>( UPDATE_TIME );
+	}
+
+	physics::Settings physics_settings;
+	physics_settings.num_threads = mOptions.physics_threads;
+	if( !mOptions.broadphase.empty() && !physics::ParseBroadphaseName( mOptions.broadphase.c_str(), physics_settings.broadphase ) )
+	{
+		std::cerr << "WARNING: Unknown broadphase " << mOptions.broadphase << ", expected dbvt, sap or sap32." << std::endl;
+	}
+	physics_settings.measure_broadphase = mOptions.physics_stress > 0;
+	// 需要看物理耗时的模式都顺便统计Bullet各阶段的耗时
+	physics_settings.profile_bullet = mOptions.physics_stress > 0 || !mOptions.benchmark_path.empty() || !mOptions.trace_path.empty();
+
+	if( !mOptions.bench_portal_pairs.empty() )
+	{
+		// 传送门压力测试自己搭场景，不加载关卡也不需要渲染
+		std::vector<int> pair_counts;
+		std::vector<int> object_counts;
+		if( !PortalBenchmark::ParseCounts( mOptions.bench_portal_pairs, pair_counts ) ||
+			!PortalBenchmark::ParseCounts( mOptions.bench_portal_objects, object_counts ) )
+		{
+			std::cerr << "ERROR: Invalid --bench-portals " << mOptions.bench_portal_pairs << " " << mOptions.bench_portal_objects
+					  << ", expected positive counts like 1,4,16 100,1000" << std::endl;
+			return false;
+		}
+		const int updates = mOptions.frames > 0 ? mOptions.frames : DEFAULT_OFFSCREEN_FRAMES;
+		mPortalBenchmark = std::make_unique<PortalBenchmark>( updates, UPDATE_TIME, physics_settings );
+		for( int pairs : pair_counts )
+		{
+			for( int objects : object_counts )
+			{
+				mPortalBenchmark->AddConfig( pairs, objects );
+			}
+		}
+		return true;
+	}
+
+	if( mOptions.bench_broadphase_boxes > 0 )
+	{
+		// 每种broadphase自己建关卡和物理世界，无头运行
+		const int updates = mOptions.frames > 0 ? mOptions.frames : DEFAULT_OFFSCREEN_FRAMES;
+		mBroadphaseBenchmark = std::make_unique<BroadphaseBenchmark>(
+			level_path, mOptions.bench_broadphase_boxes, updates, UPDATE_TIME, physics_settings, mOptions.bake_walls );
+		return true;
+	}
+
+	if( mOptions.headless )
+	{
+		// 基准测试统计的是渲染帧
+		if( mBenchmark )
+		{
+			std::cerr << "ERROR: --headless can not be combined with --benchmark" << std::endl;
+			return false;
+		}
+	}
+	else if( !InitializeRenderer() )
+	{
+		return false;
+	}
+
+	mLevelController = std::make_unique<LevelController>( mRenderer.get() );
+	mLevelController->Initialize( UPDATE_TIME, physics_settings );
+	mLevelController->SetBoxPoolCapacity( mOptions.box_pool );
+	if( mLevelController->LoadLevelFile( level_path ) )
+	{
+		mLevelController->ChangeLevelTo( level_path, mOptions.bake_walls );
+	}
+	if( mBenchmark )
+	{
+		mBenchmark->Setup( *mLevelController );
+	}
+	if( mOptions.physics_stress > 0 )
+	{
+		mLevelController->SpawnStressBoxes( mOptions.physics_stress );
+	}
+	// 录制、回放、压力测试和无头模式都用固定的物理步长，同样的输入才能得到同样的结果
+	if( mInputRecorder || mInputReplay || mOptions.physics_stress > 0 || mOptions.headless )
+	{
+		mLevelController->SetDeterministic( true );
+		// 窗口模式下更新还是由60Hz的计时器驱动，--uncapped-render照样可以按真实时间插值
+		const bool is_timer_driven = mRenderer && !mOffscreenContext && !mBenchmark && !mInputReplay;
+		mLevelController->GetPhysics().SetRealTimeInterpolation( mOptions.uncapped_render && is_timer_driven );
+	}
+
+	return true;
+}
+
+bool
+Application::InitializeRenderer()
+{
+	const bool has_context = mOptions.offscreen ? InitializeOffscreen() : InitializeWindow();
+	if( !has_context )
+	{
+		return false;
+	}
+
+	// 初始化渲染器
+	mRenderer = std::make_unique<Renderer>();
+	mRenderer->ResizeViewport( { mWindowWidth, mWindowHeight } );
+	mRenderer->GetGpuProfiler().SetEnabled( !mOptions.gpu_profile_path.empty() );
+
+	// 加载资源
+	// TODO: 每个关卡应该独立加载
+	mRenderer->GetResources().LoadTexture( "resources/textures/white_wall.jpg" );
+	mRenderer->GetResources().LoadTexture( "resources/textures/blueportal.png" );
+	mRenderer->GetResources().LoadTexture( "resources/textures/orangeportal.png" );
+	mRenderer->GetResources().LoadTexture( "resources/textures/box.jpg" );
+	mRenderer->GetResources().LoadCubeMaps( {
+		"resources/textures/sky/right.jpg",
+		"resources/textures/sky/left.jpg",
+		"resources/textures/sky/top.jpg",
+		"resources/textures/sky/bottom.jpg",
+		"resources/textures/sky/front.jpg",
+		"resources/textures/sky/back.jpg"
+	}, "SKYBOX" );
+	return true;
+}
+
+bool
+Application::InitializeWindow()
 {
 	// 初始化glut
 	glutInit( &mParams.argc, mParams.argv);
 	glutInitContextVersion( 3, 3 ); // 至少是OpenGL 3.3
 	glutInitContextProfile( GLUT_CORE_PROFILE );
 	glutInitDisplayMode( GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH );
-	glutInitWindowSize( DEFAULT_WIDTH, DEFAULT_HEIGHT );
+	glutInitWindowSize( mWindowWidth, mWindowHeight );
 	glutCreateWindow( "Shitty portal" );
 	glutSetCursor( GLUT_CURSOR_NONE );
+	// 关闭窗口时让glutMainLoop()返回，这样才有机会导出统计数据
+	glutSetOption( GLUT_ACTION_ON_WINDOW_CLOSE, GLUT_ACTION_GLUTMAINLOOP_RETURNS );
 
 	// 初始化glew
 	auto result = glewInit();
@@ -156,68 +443,293 @@ Application::Initialize()
 	// 注册glut回调
 	glutDisplayFunc( GLUTRenderCallback );
 	glutReshapeFunc( GLUTResizeCallback );
-	constexpr int not_used_value = 0;
-	glutTimerFunc( UPDATE_TIME, GLUTUpdateCallback, not_used_value );
+	if( mOptions.benchmark_path.empty() && mOptions.replay_path.empty() )
+	{
+		constexpr int not_used_value = 0;
+		glutTimerFunc( UPDATE_TIME, GLUTUpdateCallback, not_used_value );
+		if( mOptions.uncapped_render )
+		{
+			// 游戏逻辑还是由计时器驱动，空闲时只重画
+			glutIdleFunc( []() { glutPostRedisplay(); } );
+		}
+	}
+	else
+	{
+		glutIdleFunc( GLUTUncappedIdleCallback );
+	}
 	glutKeyboardFunc( GLUTKeyboardDownCallback );
 	glutKeyboardUpFunc( GLUTKeyboardUpCallback );
 	// 鼠标设在窗口在中心
 	glutWarpPointer( mWindowWidth/2, mWindowHeight/2 );
 	glutPassiveMotionFunc( GLUTMouseMoveCallback );
 	glutMouseFunc( GLUTMousePressedCallback );
+	return true;
+}
 
-	// 初始化渲染器
-	mRenderer = std::make_unique<Renderer>();
-	mRenderer->ResizeViewport( { mWindowWidth, mWindowHeight } );
-
-	// 加载资源
-	// TODO: 每个关卡应该独立加载
-	mRenderer->GetResources().LoadTexture( "resources/textures/white_wall.jpg" );
-	mRenderer->GetResources().LoadTexture( "resources/textures/blueportal.png" );
-	mRenderer->GetResources().LoadTexture( "resources/textures/orangeportal.png" );
-	mRenderer->GetResources().LoadTexture( "resources/textures/box.jpg" );
-	mRenderer->GetResources().LoadCubeMaps( {
-		"resources/textures/sky/right.jpg",
-		"resources/textures/sky/left.jpg",
-		"resources/textures/sky/top.jpg",
-		"resources/textures/sky/bottom.jpg",
-		"resources/textures/sky/front.jpg",
-		"resources/textures/sky/back.jpg"
-	}, "SKYBOX" );
+bool
+Application::InitializeOffscreen()
+{
+	mOffscreenContext = std::make_unique<OffscreenContext>( mWindowWidth, mWindowHeight );
+	if( !mOffscreenContext->Initialize() )
+	{
+		return false;
+	}
 
-	mLevelController = std::make_unique<LevelController>( *mRenderer );
-	mLevelController->Initialize( UPDATE_TIME );
-	if( mLevelController->LoadLevelFile( "resources/levels/level_intro.json" ) )
+	// Core profile下需要glewExperimental才能拿到所有函数指针
+	// 没有X11时glew会报GLEW_ERROR_NO_GLX_DISPLAY，但OpenGL函数已经初始化好了，可以忽略
+	glewExperimental = GL_TRUE;
+	auto result = glewInit();
+	if( result != GLEW_OK && result != GLEW_ERROR_NO_GLX_DISPLAY )
 	{
-		mLevelController->ChangeLevelTo( "resources/levels/level_intro.json" );
+		std::cerr << "ERROR: " << glewGetErrorString( result ) << std::endl;
+		return false;
 	}
 
+	if( !mOffscreenContext->CreateFramebuffer() )
+	{
+		return false;
+	}
+	std::cout << "Offscreen renderer: " << glGetString( GL_RENDERER ) << ", " << glGetString( GL_VERSION ) << std::endl;
 	return true;
 }
 
 void
 Application::Run()
 {
-	glutMainLoop();
+	if( mOptions.self_check )
+	{
+		physics::CheckContactEventsOnRecreate();
+		return;
+	}
+	if( mPortalBenchmark )
+	{
+		mPortalBenchmark->Run();
+	}
+	else if( mBroadphaseBenchmark )
+	{
+		if( !mBroadphaseBenchmark->Run() )
+		{
+			std::cerr << "ERROR: Broadphase benchmark failed to load its level" << std::endl;
+			mBroadphaseBenchmark.reset();
+		}
+	}
+	else if( mOptions.headless )
+	{
+		RunHeadless();
+	}
+	else if( mOffscreenContext )
+	{
+		RunOffscreen();
+	}
+	else
+	{
+		glutMainLoop();
+	}
+	Shutdown();
+}
+
+void
+Application::RunOffscreen()
+{
+	// 基准测试和回放由脚本/录像决定帧数
+	const bool is_scripted = mBenchmark || mInputReplay;
+	const int frames = mOptions.frames > 0 ? mOptions.frames : DEFAULT_OFFSCREEN_FRAMES;
+	for( int i = 0; is_scripted ? !IsScriptedRunFinished() : i < frames; i++ )
+	{
+		Update();
+		mOffscreenContext->Bind();
+		Render();
+	}
+	glFinish();
+
+	if( !mOptions.screenshot_path.empty() )
+	{
+		mOffscreenContext->SaveScreenshot( mOptions.screenshot_path );
+	}
+}
+
+void
+Application::RunHeadless()
+{
+	const int frames = mOptions.frames > 0 ? mOptions.frames : DEFAULT_OFFSCREEN_FRAMES;
+	const auto begin = std::chrono::steady_clock::now();
+	for( int i = 0; mInputReplay ? !IsScriptedRunFinished() : i < frames; i++ )
+	{
+		Update();
+	}
+	const double elapsed_ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - begin ).count();
+	std::cout << "Headless: " << mTick << " updates in " << elapsed_ms << " ms, "
+			  << ( elapsed_ms > 0.0 ? mTick * 1000.0 / elapsed_ms : 0.0 ) << " updates/s" << std::endl;
+}
+
+void
+Application::Shutdown()
+{
+	if( mRenderer && !mOptions.gpu_profile_path.empty() )
+	{
+		mRenderer->GetGpuProfiler().SaveCSV( mOptions.gpu_profile_path );
+	}
+	if( !mOptions.trace_path.empty() )
+	{
+		profiler::SaveChromeTrace( mOptions.trace_path );
+	}
+	if( mLevelController )
+	{
+		// 物理追不上时会丢步，这时的性能数据和回放结果都不可信
+		auto& stats = mLevelController->GetPhysics().GetStepStats();
+		if( stats.dropped_steps > 0 || stats.clamped_frames > 0 )
+		{
+			std::cerr << "WARNING: Physics dropped " << stats.dropped_steps << " of " << stats.steps + stats.dropped_steps
+					  << " steps, " << stats.clamped_frames << " updates were clamped" << std::endl;
+		}
+	}
+	if( mInputRecorder )
+	{
+		mInputRecorder->Save( mOptions.record_path, mTick );
+	}
+	if( !mPhysicsStepMs.empty() )
+	{
+		const Benchmark::Stats stats = Benchmark::ComputeStats( mPhysicsStepMs );
+		std::cout << "Physics stress: " << mOptions.physics_stress << " boxes, "
+				  << mLevelController->GetPhysics().GetNumThreads() << " threads, "
+				  << mPhysicsStepMs.size() << " updates, step ms avg " << stats.avg
+				  << " p50 " << stats.p50 << " p95 " << stats.p95 << " max " << stats.max << std::endl;
+		const Benchmark::Stats broadphase_stats = Benchmark::ComputeStats( mBroadphaseMs );
+		std::cout << "Broadphase " << physics::GetBroadphaseName( mLevelController->GetPhysics().GetBroadphase() )
+				  << ": pair update ms avg " << broadphase_stats.avg << " p50 " << broadphase_stats.p50
+				  << " p95 " << broadphase_stats.p95 << " max " << broadphase_stats.max << std::endl;
+		const char* phase_names[] = { "broadphase", "narrowphase", "solver", "integration" };
+		std::cout << "Bullet step ms avg/p95:";
+		for( int i = 0; i < 4; i++ )
+		{
+			const Benchmark::Stats phase_stats = Benchmark::ComputeStats( mBulletPhaseMs[i] );
+			std::cout << " " << phase_names[i] << " " << phase_stats.avg << "/" << phase_stats.p95;
+		}
+		std::cout << std::endl;
+	}
+	if( mInputReplay )
+	{
+		std::cout << "Replayed " << mTick << "/" << mInputReplay->GetTickCount() << " updates from " << mOptions.replay_path << std::endl;
+	}
+	if( mPortalBenchmark )
+	{
+		if( mOptions.benchmark_output.empty() )
+		{
+			mPortalBenchmark->WriteReport( std::cout );
+		}
+		else
+		{
+			mPortalBenchmark->SaveReport( mOptions.benchmark_output );
+		}
+	}
+	if( mBroadphaseBenchmark )
+	{
+		if( mOptions.benchmark_output.empty() )
+		{
+			mBroadphaseBenchmark->WriteReport( std::cout );
+		}
+		else
+		{
+			mBroadphaseBenchmark->SaveReport( mOptions.benchmark_output );
+		}
+	}
+	if( mBenchmark )
+	{
+		if( mOptions.benchmark_output.empty() )
+		{
+			mBenchmark->WriteReport( std::cout );
+		}
+		else
+		{
+			mBenchmark->SaveReport( mOptions.benchmark_output );
+		}
+	}
 }
 
 void
 Application::Update()
 {
+	PORTAL_PROFILE_SCOPE( "Application::Update" );
+	if( mBenchmark )
+	{
+		// 基准测试不处理玩家输入，摄像机完全由脚本控制
+		mBenchmark->BeginFrame();
+		mLevelController->Update();
+		RecordStressStep();
+		mBenchmark->ApplyCamera( *mLevelController );
+		return;
+	}
+	if( mInputReplay )
+	{
+		if( mInputReplay->IsFinished( mTick ) )
+		{
+			if( !mOffscreenContext && !mOptions.headless )
+			{
+				glutLeaveMainLoop();
+			}
+			return;
+		}
+		mInputReplay->Feed( mTick, [this]( const InputEvent& event ) { HandleInput( event ); } );
+	}
 	if( mLevelController )
 	{
 		mLevelController->HandleKeys( mKeyStatus );
 		mLevelController->Update();
+		RecordStressStep();
+	}
+	mTick++;
+}
+
+void
+Application::RecordStressStep()
+{
+	if( mOptions.physics_stress <= 0 )
+	{
+		return;
+	}
+	mPhysicsStepMs.push_back( mLevelController->GetPhysics().GetLastStepMs() );
+	mBroadphaseMs.push_back( mLevelController->GetPhysics().GetLastBroadphaseMs() );
+	const auto& step_profile = mLevelController->GetPhysics().GetLastStepProfile();
+	mBulletPhaseMs[0].push_back( step_profile.broadphase_ms );
+	mBulletPhaseMs[1].push_back( step_profile.narrowphase_ms );
+	mBulletPhaseMs[2].push_back( step_profile.solver_ms );
+	mBulletPhaseMs[3].push_back( step_profile.integration_ms );
+}
+
+bool
+Application::IsScriptedRunFinished() const
+{
+	if( mBenchmark )
+	{
+		return mBenchmark->IsFinished();
 	}
+	return mInputReplay && mInputReplay->IsFinished( mTick );
 }
 
 void
 Application::Render()
 {
+	PORTAL_PROFILE_SCOPE( "Application::Render" );
 	glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
 	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 	glDepthMask(GL_TRUE);
+	GpuProfiler& gpu_profiler = mRenderer->GetGpuProfiler();
+	gpu_profiler.BeginFrame();
+	mRenderer->ResetDrawCallCount();
 	glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT );
 	mLevelController->RenderScene();
+	gpu_profiler.EndFrame();
+
+	if( mBenchmark )
+	{
+		// 等GPU画完，帧时间才包含渲染的开销
+		glFinish();
+		mBenchmark->EndFrame( mRenderer->GetDrawCallCount(), mLevelController->GetPhysics() );
+		if( mBenchmark->IsFinished() && !mOffscreenContext )
+		{
+			glutLeaveMainLoop();
+		}
+	}
 }
 
 void 
@@ -234,38 +746,87 @@ Application::ResizeViewport(int width, int height)
 void 
 Application::MouseMoved( int x, int y )
 {
-	if( mLevelController )
-	{
-		mLevelController->HandleMouseMove( x, y );
-	}
+	InputEvent event{};
+	event.tick = mTick;
+	event.type = InputEvent::Type::MOUSE_MOVE;
+	event.x = static_cast<int16_t>( x );
+	event.y = static_cast<int16_t>( y );
+	HandleLiveInput( event );
 }
 
 void 
 Application::KeyChanged( unsigned char key, bool is_down )
 {
-	mKeyStatus[ key ] = is_down;
+	InputEvent event{};
+	event.tick = mTick;
+	event.type = InputEvent::Type::KEY;
+	event.code = key;
+	event.is_down = is_down;
+	HandleLiveInput( event );
 }
 
 void 
 Application::MousePresed( int button, bool is_pressed )
 {
-	switch( button )
+	InputEvent event{};
+	event.tick = mTick;
+	event.type = InputEvent::Type::MOUSE_BUTTON;
+	event.code = static_cast<uint8_t>( button );
+	event.is_down = is_pressed;
+	HandleLiveInput( event );
+}
+
+void
+Application::HandleLiveInput( const InputEvent& event )
+{
+	// 基准测试和回放时忽略真实的输入，回放的事件由InputReplay::Feed()送进来
+	if( mBenchmark || mInputReplay )
 	{
-	case GLUT_LEFT_BUTTON:
-		mMouseButtonState[ 1 ] = is_pressed;
+		return;
+	}
+	if( mInputRecorder )
+	{
+		mInputRecorder->Record( event );
+	}
+	HandleInput( event );
+}
+
+void
+Application::HandleInput( const InputEvent& event )
+{
+	switch( event.type )
+	{
+	case InputEvent::Type::KEY:
+		mKeyStatus[ event.code ] = event.is_down;
 		break;
-	case GLUT_RIGHT_BUTTON:
-		mMouseButtonState[ 2 ] = is_pressed;
+	case InputEvent::Type::MOUSE_MOVE:
+		if( mLevelController )
+		{
+			mLevelController->HandleMouseMove( event.x, event.y );
+		}
 		break;
-	case GLUT_MIDDLE_BUTTON:
-		mMouseButtonState[ 3 ] = is_pressed;
+	case InputEvent::Type::MOUSE_BUTTON:
+		switch( event.code )
+		{
+		case GLUT_LEFT_BUTTON:
+			mMouseButtonState[ 1 ] = event.is_down;
+			break;
+		case GLUT_RIGHT_BUTTON:
+			mMouseButtonState[ 2 ] = event.is_down;
+			break;
+		case GLUT_MIDDLE_BUTTON:
+			mMouseButtonState[ 3 ] = event.is_down;
+			break;
+		default:
+			break;
+		}
+
+		if( mLevelController )
+		{
+			mLevelController->HandleMouseButton( mMouseButtonState );
+		}
 		break;
 	default:
 		break;
 	}
-
-	if( mLevelController )
-	{
-		mLevelController->HandleMouseButton( mMouseButtonState );
-	}
 }
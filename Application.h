@@ -2,11 +2,17 @@
 #define _APPLICATION_H
 
 #include <memory>
+#include <vector>
 #include "Renderer.h"
+#include "InputRecorder.h"
 
 namespace portal
 {
 	class LevelController;
+	class OffscreenContext;
+	class Benchmark;
+	class PortalBenchmark;
+	class BroadphaseBenchmark;
 
 	class Application
 	{
@@ -15,7 +21,7 @@ namespace portal
 
 		///
 		/// 打包参数传给gluInit()
-		/// 并没有用上
+		/// 同时用于解析命令行选项，见ParseCommandLine()
 		/// 
 		struct Params
 		{
@@ -27,7 +33,7 @@ namespace portal
 		/// 创建并返回一个std::shared_ptr<Application>
 		/// 
 		/// @param parmas
-		///		命令行参数 （没有用）
+		///		命令行参数
 		/// 
 		/// @return
 		///		std::shared_ptr<Application>
@@ -40,6 +46,7 @@ namespace portal
 		static void GLUTRenderCallback();
 		static void GLUTResizeCallback( int width, int height );
 		static void GLUTUpdateCallback( int value );
+		static void GLUTUncappedIdleCallback();
 		static void GLUTMouseMoveCallback( int x, int y );
 		static void GLUTKeyboardDownCallback( unsigned char key, int x, int y );
 		static void GLUTKeyboardUpCallback( unsigned char key, int x, int y );
@@ -72,6 +79,69 @@ namespace portal
 		void Render();
 
 	private:
+		///
+		/// 命令行选项
+		/// 
+		struct Options
+		{
+			std::string gpu_profile_path; ///< --gpu-profile <file.csv> 开启GPU计时并在退出时导出
+			std::string trace_path;       ///< --trace <file.json> 开启CPU性能分析并在退出时导出Chrome trace
+			bool offscreen = false;       ///< --offscreen 不创建窗口，用EGL渲染到FBO
+			bool headless = false;        ///< --headless 不创建OpenGL context也不渲染，只尽快推进模拟
+			int frames = 0;               ///< --frames <n> 运行n帧后退出，0表示不限制（离屏模式默认600帧）
+			std::string screenshot_path;  ///< --screenshot <file.ppm> 离屏模式退出前保存最后一帧
+			std::string benchmark_path;   ///< --benchmark <script.json> 按脚本运行基准测试，结束后退出
+			std::string benchmark_output; ///< --benchmark-output <file.json> 基准测试结果，默认输出到stdout
+			std::string bench_portal_pairs;   ///< --bench-portals <pairs> <objects> 传送门穿越压力测试，两个参数都可以是逗号分隔的列表
+			std::string bench_portal_objects; ///< 同上
+			int bench_broadphase_boxes = 0;   ///< --bench-broadphases <n> 用n个盒子的物理压力测试场景依次对比所有broadphase
+			bool self_check = false;      ///< --self-check 运行物理的自检后退出，不加载关卡也不渲染
+			std::string record_path;      ///< --record <file.inp> 录制输入，退出时保存
+			std::string replay_path;      ///< --replay <file.inp> 回放录制的输入，回放完后退出
+			bool uncapped_render = false; ///< --uncapped-render 渲染不再跟着游戏逻辑60Hz更新，物体位置插值
+			int physics_threads = 1;      ///< --physics-threads <n> 物理模拟线程数，0表示所有CPU核心
+			int physics_stress = 0;       ///< --physics-stress <n> 生成n个盒子做物理压力测试，退出时输出物理耗时
+			std::string broadphase;       ///< --broadphase <dbvt|sap|sap32> 物理使用的broadphase，默认dbvt
+			bool bake_walls = false;      ///< --bake-walls 关卡的墙合并成一个静态碰撞体
+			int box_pool = 16;            ///< --box-pool <n> 按E发射的盒子最多同时存在n个
+		};
+
+		///
+		/// 创建GLUT窗口和OpenGL Context
+		/// 
+		bool InitializeWindow();
+
+		///
+		/// 创建EGL离屏OpenGL Context
+		/// 
+		bool InitializeOffscreen();
+
+		///
+		/// 创建窗口或离屏context，然后创建渲染器并加载资源
+		/// 
+		bool InitializeRenderer();
+
+		///
+		/// 离屏模式的主循环，每次循环更新一次逻辑并渲染一帧
+		/// 
+		void RunOffscreen();
+
+		///
+		/// 无头模式的主循环，只更新游戏逻辑，不等待也不渲染
+		/// 退出时输出更新次数和每秒更新数
+		/// 
+		void RunHeadless();
+
+		///
+		/// 从mParams解析命令行选项，不认识的参数留给glutInit()
+		/// 
+		void ParseCommandLine();
+
+		///
+		/// 主循环结束后导出统计数据
+		/// 
+		void Shutdown();
+
 		///
 		/// 改变视口大小
 		/// 
@@ -104,14 +174,45 @@ namespace portal
 
 		void MousePresed( int button, bool is_pressed );
 
+		///
+		/// 窗口的输入事件，录制后交给HandleInput()，基准测试和回放时丢弃
+		/// 
+		void HandleLiveInput( const InputEvent& event );
+
+		///
+		/// 把输入事件交给关卡处理，真实输入和回放共用这一个入口
+		/// 
+		void HandleInput( const InputEvent& event );
+
+		///
+		/// 基准测试或回放是否已经结束
+		/// 
+		bool IsScriptedRunFinished() const;
+
+		///
+		/// --physics-stress时记录这一次更新的物理耗时，基准测试和普通更新都要调用
+		/// 
+		void RecordStressStep();
+
 	private:
 		static Ptr sInstance;
 
 		Params mParams;
+		Options mOptions;
 		int mWindowWidth;
 		int mWindowHeight;
+		std::unique_ptr<OffscreenContext> mOffscreenContext;
 		std::unique_ptr<Renderer> mRenderer;
 		std::unique_ptr<LevelController> mLevelController;
+		std::unique_ptr<Benchmark> mBenchmark;
+		std::unique_ptr<PortalBenchmark> mPortalBenchmark;
+		std::unique_ptr<BroadphaseBenchmark> mBroadphaseBenchmark;
+		std::unique_ptr<InputRecorder> mInputRecorder;
+		std::unique_ptr<InputReplay> mInputReplay;
+		uint32_t mTick; ///< 游戏逻辑已经更新的次数
+		std::vector<double> mPhysicsStepMs; ///< 物理压力测试中每次更新的物理耗时
+		std::vector<double> mBroadphaseMs;  ///< 同上，其中broadphase更新重叠对的耗时
+		std::vector<double> mBulletPhaseMs[4]; ///< 同上，Bullet的broadphase、narrowphase、solver和integration阶段的耗时
 		std::unordered_map<unsigned int, bool> mKeyStatus;
 		std::unordered_map<int, bool> mMouseButtonState;
 	};
@@ -0,0 +1,279 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+
+#include <glm/common.hpp>
+
+#include <rapidjson/document.h>
+#include <rapidjson/istreamwrapper.h>
+#include <rapidjson/ostreamwrapper.h>
+#include <rapidjson/prettywriter.h>
+
+#include "LevelController.h"
+
+using namespace portal;
+
+namespace
+{
+	constexpr int DEFAULT_FRAMES = 1200;
+	constexpr int DEFAULT_WARMUP_FRAMES = 60;
+
+	glm::vec3
+	read_vec3( const rapidjson::Value& value )
+	{
+		return {
+			value[ "x" ].GetFloat(),
+			value[ "y" ].GetFloat(),
+			value[ "z" ].GetFloat()
+		};
+	}
+
+	// 均匀Catmull-Rom样条，曲线经过p1和p2
+	glm::vec3
+	catmull_rom( const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3, float t )
+	{
+		const float t2 = t * t;
+		const float t3 = t2 * t;
+		return 0.5f * ( ( 2.f * p1 ) +
+						( -p0 + p2 ) * t +
+						( 2.f * p0 - 5.f * p1 + 4.f * p2 - p3 ) * t2 +
+						( -p0 + 3.f * p1 - 3.f * p2 + p3 ) * t3 );
+	}
+}
+
+Benchmark::Benchmark()
+	: mFrames( DEFAULT_FRAMES )
+	, mWarmupFrames( DEFAULT_WARMUP_FRAMES )
+	, mIsLooped( false )
+	, mCurrentFrame( 0 )
+	, mPlacedPortals( 0 )
+{
+}
+
+bool
+Benchmark::LoadScript( const std::string& path )
+{
+	std::ifstream ifs{ path };
+	if( !ifs.is_open() )
+	{
+		std::cerr << "ERROR: Failed to open benchmark script " << path << std::endl;
+		return false;
+	}
+
+	rapidjson::IStreamWrapper isw{ ifs };
+	rapidjson::Document json_doc;
+	json_doc.ParseStream( isw );
+	if( json_doc.HasParseError() || !json_doc.IsObject() )
+	{
+		std::cerr << "ERROR: Failed to parse benchmark script: " << path << ", msg: " << std::to_string( static_cast<int>( json_doc.GetParseError() ) ) << std::endl;
+		return false;
+	}
+
+	if( !json_doc.HasMember( "level" ) || !json_doc.HasMember( "camera" ) )
+	{
+		std::cerr << "ERROR: Benchmark script " << path << " requires \"level\" and \"camera\"" << std::endl;
+		return false;
+	}
+
+	mScriptPath = path;
+	mLevelPath = json_doc[ "level" ].GetString();
+	if( json_doc.HasMember( "frames" ) )
+	{
+		mFrames = std::max( json_doc[ "frames" ].GetInt(), 1 );
+	}
+	if( json_doc.HasMember( "warmup_frames" ) )
+	{
+		mWarmupFrames = std::max( json_doc[ "warmup_frames" ].GetInt(), 0 );
+	}
+	if( json_doc.HasMember( "loop" ) )
+	{
+		mIsLooped = json_doc[ "loop" ].GetBool();
+	}
+
+	// 传送门用射线放置，和玩家开枪一样，这样传送门能找到附着的墙
+	if( json_doc.HasMember( "portals" ) )
+	{
+		for( auto& shot : json_doc[ "portals" ].GetArray() )
+		{
+			mPortalShots.push_back( { read_vec3( shot[ "from" ] ), read_vec3( shot[ "to" ] ) } );
+		}
+	}
+
+	for( auto& key : json_doc[ "camera" ].GetArray() )
+	{
+		mCameraKeys.push_back( { read_vec3( key[ "pos" ] ), read_vec3( key[ "target" ] ) } );
+	}
+	if( mCameraKeys.empty() )
+	{
+		std::cerr << "ERROR: Benchmark script " << path << " has no camera keys" << std::endl;
+		return false;
+	}
+
+	mFrameMs.reserve( mFrames );
+	mDrawCalls.reserve( mFrames );
+	mPhysicsStepMs.reserve( mFrames );
+	return true;
+}
+
+const std::string&
+Benchmark::GetLevelPath() const
+{
+	return mLevelPath;
+}
+
+void
+Benchmark::Setup( LevelController& level_controller )
+{
+	level_controller.SetDeterministic( true );
+	mPlacedPortals = 0;
+	for( size_t i = 0; i < mPortalShots.size(); i++ )
+	{
+		if( level_controller.PlacePortal( static_cast<int>( i ), mPortalShots[i].from, mPortalShots[i].to ) )
+		{
+			mPlacedPortals++;
+		}
+		else
+		{
+			std::cerr << "WARNING: Benchmark failed to place portal " << i << std::endl;
+		}
+	}
+}
+
+bool
+Benchmark::IsFinished() const
+{
+	return mCurrentFrame >= mWarmupFrames + mFrames;
+}
+
+void
+Benchmark::BeginFrame()
+{
+	mFrameBegin = std::chrono::steady_clock::now();
+}
+
+void
+Benchmark::ApplyCamera( LevelController& level_controller )
+{
+	// 预热阶段停在起点
+	const int frame = std::max( mCurrentFrame - mWarmupFrames, 0 );
+	const float t = mFrames > 1 ? static_cast<float>( frame ) / static_cast<float>( mFrames - 1 ) : 0.f;
+	const CameraKey key = SampleCamera( t );
+	level_controller.SetCameraPose( key.position, key.target );
+}
+
+void
+Benchmark::EndFrame( unsigned int draw_calls, const physics::Physics& physics )
+{
+	if( IsFinished() )
+	{
+		return;
+	}
+	if( mCurrentFrame >= mWarmupFrames )
+	{
+		mFrameMs.push_back( std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - mFrameBegin ).count() );
+		mDrawCalls.push_back( static_cast<double>( draw_calls ) );
+		mPhysicsStepMs.push_back( static_cast<double>( physics.GetLastStepMs() ) );
+		const auto& step_profile = physics.GetLastStepProfile();
+		mBroadphaseMs.push_back( static_cast<double>( step_profile.broadphase_ms ) );
+		mNarrowphaseMs.push_back( static_cast<double>( step_profile.narrowphase_ms ) );
+		mSolverMs.push_back( static_cast<double>( step_profile.solver_ms ) );
+		mIntegrationMs.push_back( static_cast<double>( step_profile.integration_ms ) );
+	}
+	mCurrentFrame++;
+}
+
+void
+Benchmark::WriteReport( std::ostream& os ) const
+{
+	rapidjson::OStreamWrapper osw{ os };
+	rapidjson::PrettyWriter<rapidjson::OStreamWrapper> writer{ osw };
+	writer.StartObject();
+	writer.Key( "script" ); writer.String( mScriptPath.c_str() );
+	writer.Key( "level" ); writer.String( mLevelPath.c_str() );
+	writer.Key( "frames" ); writer.Int( static_cast<int>( mFrameMs.size() ) );
+	writer.Key( "warmup_frames" ); writer.Int( mWarmupFrames );
+	writer.Key( "portals_placed" ); writer.Int( mPlacedPortals );
+	WriteStats( writer, "frame_ms", ComputeStats( mFrameMs ) );
+	WriteStats( writer, "draw_calls", ComputeStats( mDrawCalls ) );
+	WriteStats( writer, "physics_step_ms", ComputeStats( mPhysicsStepMs ) );
+	WriteStats( writer, "bullet_broadphase_ms", ComputeStats( mBroadphaseMs ) );
+	WriteStats( writer, "bullet_narrowphase_ms", ComputeStats( mNarrowphaseMs ) );
+	WriteStats( writer, "bullet_solver_ms", ComputeStats( mSolverMs ) );
+	WriteStats( writer, "bullet_integration_ms", ComputeStats( mIntegrationMs ) );
+	writer.EndObject();
+	os << std::endl;
+}
+
+bool
+Benchmark::SaveReport( const std::string& path ) const
+{
+	std::ofstream ofs{ path };
+	if( !ofs.is_open() )
+	{
+		std::cerr << "ERROR: Failed to open benchmark report " << path << std::endl;
+		return false;
+	}
+	WriteReport( ofs );
+	return true;
+}
+
+/*static*/
+Benchmark::Stats
+Benchmark::ComputeStats( std::vector<double> samples )
+{
+	Stats stats;
+	if( samples.empty() )
+	{
+		return stats;
+	}
+	std::sort( samples.begin(), samples.end() );
+	auto percentile = [&]( double p )
+	{
+		const size_t rank = static_cast<size_t>( std::ceil( p * samples.size() ) );
+		return samples[ std::min( std::max<size_t>( rank, 1 ), samples.size() ) - 1 ];
+	};
+	stats.min = samples.front();
+	stats.max = samples.back();
+	stats.avg = std::accumulate( samples.begin(), samples.end(), 0.0 ) / samples.size();
+	stats.p50 = percentile( 0.50 );
+	stats.p95 = percentile( 0.95 );
+	stats.p99 = percentile( 0.99 );
+	return stats;
+}
+
+Benchmark::CameraKey
+Benchmark::SampleCamera( float t ) const
+{
+	const int num_keys = static_cast<int>( mCameraKeys.size() );
+	if( num_keys == 1 )
+	{
+		return mCameraKeys.front();
+	}
+
+	// 循环路径的最后一段回到第一个关键帧
+	const int num_segments = mIsLooped ? num_keys : num_keys - 1;
+	const float segment_pos = glm::clamp( t, 0.f, 1.f ) * num_segments;
+	const int segment = std::min( static_cast<int>( segment_pos ), num_segments - 1 );
+	const float local_t = segment_pos - segment;
+
+	auto key_at = [&]( int index ) -> const CameraKey&
+	{
+		if( mIsLooped )
+		{
+			return mCameraKeys[ ( index % num_keys + num_keys ) % num_keys ];
+		}
+		return mCameraKeys[ std::min( std::max( index, 0 ), num_keys - 1 ) ];
+	};
+	const CameraKey& k0 = key_at( segment - 1 );
+	const CameraKey& k1 = key_at( segment );
+	const CameraKey& k2 = key_at( segment + 1 );
+	const CameraKey& k3 = key_at( segment + 2 );
+	return {
+		catmull_rom( k0.position, k1.position, k2.position, k3.position, local_t ),
+		catmull_rom( k0.target, k1.target, k2.target, k3.target, local_t )
+	};
+}
@@ -0,0 +1,174 @@
+#ifndef _BENCHMARK_H
+#define _BENCHMARK_H
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <ostream>
+#include <glm/vec3.hpp>
+
+namespace portal
+{
+	class LevelController;
+
+	namespace physics
+	{
+		class Physics;
+	}
+
+	///
+	/// 可重复的渲染基准测试
+	/// 从脚本文件读取关卡、传送门位置和摄像机路径，摄像机沿Catmull-Rom样条曲线移动固定帧数，
+	/// 期间不处理玩家输入，物理每帧固定推进一个更新间隔。
+	/// 结束后输出帧时间、draw call和物理耗时的统计（JSON），物理开了Settings::profile_bullet时还有Bullet各阶段的耗时。
+	///
+	/// 脚本格式见 resources/benchmarks/flythrough_intro.json
+	///
+	class Benchmark
+	{
+	public:
+		///
+		/// 一组数据的统计
+		///
+		struct Stats
+		{
+			double min = 0.0;
+			double avg = 0.0;
+			double p50 = 0.0;
+			double p95 = 0.0;
+			double p99 = 0.0;
+			double max = 0.0;
+		};
+
+		Benchmark();
+		~Benchmark() = default;
+
+		///
+		/// 读取基准测试脚本
+		///
+		/// @param path
+		///		脚本文件路径
+		///
+		/// @return
+		///		True表示成功
+		///
+		bool LoadScript( const std::string& path );
+
+		///
+		/// 脚本指定的关卡文件
+		///
+		const std::string& GetLevelPath() const;
+
+		///
+		/// 关卡加载后调用，放置脚本里的传送门
+		///
+		void Setup( LevelController& level_controller );
+
+		///
+		/// 是否已经跑完所有帧
+		///
+		bool IsFinished() const;
+
+		///
+		/// 一帧开始，在更新游戏逻辑之前调用
+		///
+		void BeginFrame();
+
+		///
+		/// 根据当前帧在样条曲线上的位置设置摄像机，在更新游戏逻辑之后调用
+		///
+		void ApplyCamera( LevelController& level_controller );
+
+		///
+		/// 一帧结束，在渲染结束并glFinish()之后调用
+		///
+		/// @param draw_calls
+		///		本帧的draw call数量
+		///
+		/// @param physics
+		///		读取本帧物理模拟的耗时
+		///
+		void EndFrame( unsigned int draw_calls, const physics::Physics& physics );
+
+		///
+		/// 输出统计结果
+		///
+		void WriteReport( std::ostream& os ) const;
+		bool SaveReport( const std::string& path ) const;
+
+		///
+		/// 计算统计（百分位数用最近秩法）
+		///
+		static Stats ComputeStats( std::vector<double> samples );
+
+		///
+		/// 把一组统计写成JSON对象 { "min", "avg", "p50", "p95", "p99", "max" }
+		/// 所有基准测试的报告都用它，保证格式一致
+		///
+		/// @param writer
+		///		rapidjson的Writer
+		///
+		/// @param name
+		///		对象的键名
+		///
+		template<typename Writer>
+		static void WriteStats( Writer& writer, const char* name, const Stats& stats );
+
+	private:
+		struct CameraKey
+		{
+			glm::vec3 position;
+			glm::vec3 target;
+		};
+
+		struct PortalShot
+		{
+			glm::vec3 from;
+			glm::vec3 to;
+		};
+
+		///
+		/// 在摄像机路径上取点
+		///
+		/// @param t
+		///		[0.0 - 1.0]，整条路径的进度
+		///
+		CameraKey SampleCamera( float t ) const;
+
+		std::string mScriptPath;
+		std::string mLevelPath;
+		int mFrames;
+		int mWarmupFrames;
+		bool mIsLooped;
+		std::vector<PortalShot> mPortalShots;
+		std::vector<CameraKey> mCameraKeys;
+
+		int mCurrentFrame;
+		std::chrono::steady_clock::time_point mFrameBegin;
+		std::vector<double> mFrameMs;
+		std::vector<double> mDrawCalls;
+		std::vector<double> mPhysicsStepMs;
+		std::vector<double> mBroadphaseMs;
+		std::vector<double> mNarrowphaseMs;
+		std::vector<double> mSolverMs;
+		std::vector<double> mIntegrationMs;
+		int mPlacedPortals;
+	};
+
+	template<typename Writer>
+	void
+	Benchmark::WriteStats( Writer& writer, const char* name, const Stats& stats )
+	{
+		writer.Key( name );
+		writer.StartObject();
+		writer.Key( "min" ); writer.Double( stats.min );
+		writer.Key( "avg" ); writer.Double( stats.avg );
+		writer.Key( "p50" ); writer.Double( stats.p50 );
+		writer.Key( "p95" ); writer.Double( stats.p95 );
+		writer.Key( "p99" ); writer.Double( stats.p99 );
+		writer.Key( "max" ); writer.Double( stats.max );
+		writer.EndObject();
+	}
+}
+
+#endif
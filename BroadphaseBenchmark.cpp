@@ -0,0 +1,128 @@
+#include "BroadphaseBenchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+#include <rapidjson/ostreamwrapper.h>
+#include <rapidjson/prettywriter.h>
+
+#include "Benchmark.h"
+#include "LevelController.h"
+#include "Profiler.h"
+
+using namespace portal;
+
+BroadphaseBenchmark::BroadphaseBenchmark( const std::string& level_path,
+										  int boxes,
+										  int updates,
+										  int update_interval_ms,
+										  const physics::Settings& physics_settings,
+										  bool bake_static_walls )
+	: mLevelPath( level_path )
+	, mBoxes( std::max( boxes, 1 ) )
+	, mUpdates( std::max( updates, 1 ) )
+	, mUpdateIntervalMs( update_interval_ms )
+	, mPhysicsSettings( physics_settings )
+	, mIsBakingWalls( bake_static_walls )
+{}
+
+BroadphaseBenchmark::~BroadphaseBenchmark()
+{}
+
+bool
+BroadphaseBenchmark::Run()
+{
+	mResults.clear();
+	for( physics::Broadphase broadphase : physics::ALL_BROADPHASES )
+	{
+		PORTAL_PROFILE_SCOPE( "BroadphaseBenchmark::RunBroadphase" );
+		Result result;
+		if( !RunBroadphase( broadphase, result ) )
+		{
+			return false;
+		}
+		const Benchmark::Stats stats = Benchmark::ComputeStats( result.pair_update_ms );
+		std::cerr << "Broadphase benchmark: " << physics::GetBroadphaseName( broadphase ) << ", " << mBoxes << " boxes, "
+				  << "pair update ms avg " << stats.avg << " p95 " << stats.p95 << ", " << result.wall_ms << " ms" << std::endl;
+		mResults.push_back( std::move( result ) );
+	}
+	return true;
+}
+
+bool
+BroadphaseBenchmark::RunBroadphase( physics::Broadphase broadphase, Result& result ) const
+{
+	result.broadphase = broadphase;
+	result.pair_update_ms.reserve( mUpdates );
+	result.physics_step_ms.reserve( mUpdates );
+
+	physics::Settings settings = mPhysicsSettings;
+	settings.broadphase = broadphase;
+	settings.measure_broadphase = true;
+
+	// 每种broadphase都从头搭一遍场景，互不影响
+	auto level_controller = std::make_unique<LevelController>( nullptr );
+	level_controller->Initialize( mUpdateIntervalMs, settings );
+	if( !level_controller->LoadLevelFile( mLevelPath ) )
+	{
+		return false;
+	}
+	level_controller->ChangeLevelTo( mLevelPath, mIsBakingWalls );
+	level_controller->SpawnStressBoxes( mBoxes );
+	level_controller->SetDeterministic( true );
+
+	auto& physics = level_controller->GetPhysics();
+	const auto run_begin = std::chrono::steady_clock::now();
+	for( int update = 0; update < mUpdates; update++ )
+	{
+		level_controller->Update();
+		result.pair_update_ms.push_back( physics.GetLastBroadphaseMs() );
+		result.physics_step_ms.push_back( physics.GetLastStepMs() );
+	}
+	result.wall_ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - run_begin ).count();
+	return true;
+}
+
+void
+BroadphaseBenchmark::WriteReport( std::ostream& os ) const
+{
+	rapidjson::OStreamWrapper osw{ os };
+	rapidjson::PrettyWriter<rapidjson::OStreamWrapper> writer{ osw };
+	writer.StartObject();
+	writer.Key( "level" ); writer.String( mLevelPath.c_str() );
+	writer.Key( "boxes" ); writer.Int( mBoxes );
+	writer.Key( "updates" ); writer.Int( mUpdates );
+	writer.Key( "update_interval_ms" ); writer.Int( mUpdateIntervalMs );
+	writer.Key( "physics_threads" ); writer.Int( mPhysicsSettings.num_threads );
+	writer.Key( "bake_walls" ); writer.Bool( mIsBakingWalls );
+	writer.Key( "broadphases" );
+	writer.StartObject();
+	for( auto& result : mResults )
+	{
+		writer.Key( physics::GetBroadphaseName( result.broadphase ) );
+		writer.StartObject();
+		writer.Key( "wall_ms" ); writer.Double( result.wall_ms );
+		Benchmark::WriteStats( writer, "pair_update_ms", Benchmark::ComputeStats( result.pair_update_ms ) );
+		Benchmark::WriteStats( writer, "physics_step_ms", Benchmark::ComputeStats( result.physics_step_ms ) );
+		writer.EndObject();
+	}
+	writer.EndObject();
+	writer.EndObject();
+	os << std::endl;
+}
+
+bool
+BroadphaseBenchmark::SaveReport( const std::string& path ) const
+{
+	std::ofstream ofs{ path };
+	if( !ofs.is_open() )
+	{
+		std::cerr << "ERROR: Failed to open broadphase benchmark report " << path << std::endl;
+		return false;
+	}
+	WriteReport( ofs );
+	return true;
+}
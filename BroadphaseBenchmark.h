@@ -0,0 +1,85 @@
+#ifndef _BROADPHASE_BENCHMARK_H
+#define _BROADPHASE_BENCHMARK_H
+
+#include <vector>
+#include <string>
+#include <ostream>
+
+#include "Physics.h"
+
+namespace portal
+{
+	///
+	/// broadphase的对比测试
+	/// 对每一种physics::Broadphase各跑一遍同样的物理压力测试场景（LevelController::SpawnStressBoxes()，固定种子），
+	/// 每次都新建LevelController和物理世界，无头模式，物理每次更新固定推进一步。
+	/// 结束后输出每种broadphase更新重叠对和物理模拟的耗时（JSON，按GetBroadphaseName()的名字）
+	///
+	class BroadphaseBenchmark
+	{
+	public:
+		///
+		/// 构造函数
+		///
+		/// @param level_path
+		///		压力测试的关卡
+		///
+		/// @param boxes
+		///		盒子数量
+		///
+		/// @param updates
+		///		每种broadphase运行的更新次数
+		///
+		/// @param update_interval_ms
+		///		每次更新物理推进的时间
+		///
+		/// @param physics_settings
+		///		物理世界的配置，broadphase和measure_broadphase会被覆盖
+		///
+		/// @param bake_static_walls
+		///		见LevelController::ChangeLevelTo()
+		///
+		BroadphaseBenchmark( const std::string& level_path,
+							 int boxes,
+							 int updates,
+							 int update_interval_ms,
+							 const physics::Settings& physics_settings,
+							 bool bake_static_walls );
+		~BroadphaseBenchmark();
+
+		///
+		/// 按physics::ALL_BROADPHASES的顺序运行
+		///
+		/// @return
+		///		关卡加载失败时返回false
+		///
+		bool Run();
+
+		///
+		/// 输出统计结果
+		///
+		void WriteReport( std::ostream& os ) const;
+		bool SaveReport( const std::string& path ) const;
+
+	private:
+		struct Result
+		{
+			physics::Broadphase broadphase;
+			double wall_ms = 0.0;                ///< 整个场景运行的真实时间
+			std::vector<double> pair_update_ms;  ///< 每次更新broadphase更新AABB和重叠对的耗时
+			std::vector<double> physics_step_ms; ///< 每次更新的物理模拟耗时
+		};
+
+		bool RunBroadphase( physics::Broadphase broadphase, Result& result ) const;
+
+		std::string mLevelPath;
+		int mBoxes;
+		int mUpdates;
+		int mUpdateIntervalMs;
+		physics::Settings mPhysicsSettings;
+		bool mIsBakingWalls;
+		std::vector<Result> mResults;
+	};
+}
+
+#endif
@@ -33,6 +33,35 @@ namespace portal
 		}
 	)~~~";
 
+	// 和默认顶点shader一样，但是模型矩阵是每个实例一份的顶点属性（占用location 4-7）
+	const std::string INSTANCED_VERTEX_SHADER = R"~~~(
+		#version 330 core
+		layout (location = 0) in vec3 in_pos;
+		layout (location = 1) in vec4 in_color;
+		layout (location = 2) in vec2 in_uv;
+		layout (location = 3) in vec3 in_normal;
+		layout (location = 4) in mat4 in_model_mat;
+
+		out vec2 tex_coord;
+		out vec4 color;
+		out vec3 frag_pos;
+		out vec3 normal;
+
+		uniform mat4 view_mat;
+		uniform mat4 projection_mat;
+		
+		void main()
+		{
+			mat4 model_view = view_mat * in_model_mat;
+			gl_Position = projection_mat * model_view * vec4( in_pos, 1.0 );
+			frag_pos = vec3( in_model_mat * vec4( in_pos, 1.0 ) );
+			tex_coord = in_uv;
+			color = in_color;
+			vec4 temp_normal = transpose( inverse( in_model_mat ) ) * vec4( in_normal, 1.0 );
+			normal = temp_normal.xyz;
+		}
+	)~~~";
+
 	const std::string DEFAULT_FRAGMENT_SHADER = R"~~~(
 		#version 330 core
 		out vec4 frag_color;
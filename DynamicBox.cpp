@@ -1,7 +1,6 @@
 ﻿#include "DynamicBox.h"
 
 #include "LevelConstants.h"
-#include "Utility.h"
 #include "Portal.h"
 
 #include <glm/gtc/matrix_transform.hpp>
@@ -10,20 +9,23 @@ using namespace portal;
 using namespace portal::physics;
 using namespace portal::level;
 
-DynamicBox::DynamicBox( physics::Physics& physics, glm::vec3 pos, TextureInfo* texture )
-	: Renderer::Renderable( utility::generate_box_vertices( glm::vec3{ 0.f }, 5.f, 5.f, 5.f, 1.f ), Renderer::DEFAULT_SHADER, texture )
-	, mClone( utility::generate_box_vertices( glm::vec3{ 0.f }, 5.f, 5.f, 5.f, 1.f ), Renderer::DEFAULT_SHADER, texture )
-	, mPhysics( physics )
+DynamicBox::DynamicBox( physics::Physics& physics, glm::vec3 pos )
+	: mPhysics( physics )
+	, mRenderTransform( glm::translate( glm::mat4( 1.f ), pos ) )
+	, mCloneRenderTransform( 1.f )
+	, mCloneTransform( 1.f )
+	, mIsCloneVisible( false )
+	, mIsRenderSynced( false )
 {
 	mCollisionBox = mPhysics.CreateBox(
 		pos,
-		{ 5.f, 5.f, 5.f },
+		{ SIZE, SIZE, SIZE },
 		Physics::PhysicsObject::Type::DYNAMIC,
 		static_cast<int>( PhysicsGroup::BOX ),
 		static_cast<int>( PhysicsGroup::WALL ) | static_cast<int>( PhysicsGroup::PORTAL_FRAME ) | static_cast<int>( PhysicsGroup::PLAYER )
 	);
 	//mCollisionBox->SetAngularFactor( { 0.f, 0.f, 0.f } );
-	mPortalablePO = mCollisionBox.get();
+	SetPortalableObject( mCollisionBox.get() );
 }
 
 DynamicBox::~DynamicBox()
@@ -36,6 +38,7 @@ DynamicBox::Teleport( Portal& in_portal )
 	glm::vec3 prev_pos = mCollisionBox->GetPosition();
 	glm::vec3 new_pos = in_portal.ConvertPointToOutPortal( prev_pos );
 	mCollisionBox->SetPosition( new_pos );
+	mCollisionBox->Activate();
 
 	glm::vec3 velocity = mCollisionBox->GetLinearVelocity();
 	velocity = in_portal.ConvertDirectionToOutPortal( std::move( velocity ), std::move( prev_pos ), std::move( new_pos ) );
@@ -50,34 +53,104 @@ DynamicBox::Teleport( Portal& in_portal )
 void
 DynamicBox::Update()
 {
-	mCollisionBox->Activate();
-	SetTransform( mCollisionBox->GetTransform() );
+	// 睡眠的物体不会动，渲染位置已经是最后一步的结果
+	if( !mCollisionBox->IsActive() && mIsRenderSynced )
+	{
+		return;
+	}
+	mRenderTransform = mCollisionBox->GetTransform();
+}
+
+void
+DynamicBox::Interpolate( float alpha )
+{
+	const bool is_active = mCollisionBox->IsActive();
+	if( !is_active && mIsRenderSynced )
+	{
+		return;
+	}
+	mRenderTransform = mCollisionBox->GetInterpolatedTransform( alpha );
+	mCloneRenderTransform = mCloneTransform * mRenderTransform;
+	// 睡着后再同步一次就不用再管了，醒来时重新开始同步
+	mIsRenderSynced = !is_active;
 }
 
 void 
 DynamicBox::SetPosition( glm::vec3 pos )
 {
 	mCollisionBox->SetPosition( std::move( pos ) );
+	mCollisionBox->Activate();
 }
 
 void 
 DynamicBox::Launch( glm::vec3 force )
 {
+	mCollisionBox->Activate();
 	mCollisionBox->SetImpluse( std::move( force ), glm::vec3{ 0.f } );
 }
 
+void
+DynamicBox::Respawn( glm::vec3 pos )
+{
+	mCollisionBox->SetPosition( pos );
+	mCollisionBox->SetLinearVelocity( glm::vec3{ 0.f } );
+	mCollisionBox->SetAngularVelocity( glm::vec3{ 0.f } );
+	mCollisionBox->Activate();
+	mRenderTransform = glm::translate( glm::mat4( 1.f ), pos );
+	mIsCloneVisible = false;
+	mIsRenderSynced = false;
+}
+
+void
+DynamicBox::ResetRenderState()
+{
+	mRenderTransform = mCollisionBox->GetTransform();
+	mIsCloneVisible = false;
+	mIsRenderSynced = false;
+}
+
+void
+DynamicBox::UpdateClone( const std::vector<Portal*>& portals )
+{
+	mIsCloneVisible = false;
+	for( auto portal : portals )
+	{
+		if( portal && portal->IsPortalableEntering( this ) )
+		{
+			// Clone!
+			CloneAt( *portal );
+			mIsCloneVisible = true;
+		}
+	}
+}
+
 void 
 DynamicBox::CloneAt( Portal& in_portal )
 {
-	auto trans = in_portal.GetPairedPortal()->GetHoleRenderable()->GetTransform()
-		* glm::rotate( glm::mat4( 1.f ), glm::radians( 180.f ), glm::vec3( 0.f, 1.f, 0.f ) ) 
-		* glm::inverse( in_portal.GetHoleRenderable()->GetTransform() ) 
-		* mCollisionBox->GetTransform();
-	mClone.SetTransform( std::move( trans ) );
+	mCloneTransform = in_portal.GetTransformToPair();
+	mCloneRenderTransform = mCloneTransform * mCollisionBox->GetTransform();
+}
+
+bool
+DynamicBox::IsCloneVisible() const
+{
+	return mIsCloneVisible;
+}
+
+const glm::mat4&
+DynamicBox::GetRenderTransform() const
+{
+	return mRenderTransform;
+}
+
+const glm::mat4&
+DynamicBox::GetCloneRenderTransform() const
+{
+	return mCloneRenderTransform;
 }
 
-Renderer::Renderable* 
-DynamicBox::GetClone()
+Physics::Box&
+DynamicBox::GetCollisionBox()
 {
-	return &mClone;
+	return *mCollisionBox;
 }
@@ -1,31 +1,73 @@
 #ifndef _DYNAMIC_BOX_H
 #define _DYNAMIC_BOX_H
 
+#include <vector>
+
 #include "Portalable.h"
 #include "Physics.h"
-#include "Renderer.h"
 
 namespace portal
 {
-	class DynamicBox : public Portalable, public Renderer::Renderable
+	///
+	/// 可以被发射、穿过传送门的盒子
+	/// 只有物理和渲染用的变换矩阵，模型由DynamicBoxPool统一实例化绘制
+	///
+	class DynamicBox : public Portalable
 	{
 	public:
-		DynamicBox( physics::Physics& physics, glm::vec3 pos, TextureInfo* texture );
+		static constexpr float SIZE = 5.f;
+
+		DynamicBox( physics::Physics& physics, glm::vec3 pos );
 		~DynamicBox();
 
 		virtual void Teleport( Portal& in_portal ) override;
 
 		void Update();
 
+		///
+		/// 渲染前调用，把渲染位置设为上一步和当前步物理结果之间的插值
+		///
+		/// @param alpha
+		///		Physics::GetInterpolationAlpha()
+		///
+		void Interpolate( float alpha );
+
 		void SetPosition( glm::vec3 pos );
 		void Launch( glm::vec3 force );
+
+		///
+		/// 重新放到pos，速度清零，克隆隐藏。对象池回收盒子时使用
+		///
+		void Respawn( glm::vec3 pos );
+
+		///
+		/// 物体被外部直接改变（比如恢复物理快照）后调用，渲染位置重新和物理同步，克隆隐藏
+		/// 
+		void ResetRenderState();
+
+		///
+		/// 盒子在某个传送门门口时，在出口画一个克隆
+		///
+		/// @param portals
+		///		所有传送门，可以包含nullptr
+		///
+		void UpdateClone( const std::vector<Portal*>& portals );
 		void CloneAt( Portal& in_portal );
-		Renderer::Renderable* GetClone();
+		bool IsCloneVisible() const;
+
+		const glm::mat4& GetRenderTransform() const;
+		const glm::mat4& GetCloneRenderTransform() const;
+
+		physics::Physics::Box& GetCollisionBox();
 
 	private:
 		std::unique_ptr<physics::Physics::Box> mCollisionBox;
 		physics::Physics& mPhysics;
-		Renderer::Renderable mClone;
+		glm::mat4 mRenderTransform;
+		glm::mat4 mCloneRenderTransform;
+		glm::mat4 mCloneTransform; //< 从入口到出口传送门的变换
+		bool mIsCloneVisible;
+		bool mIsRenderSynced;      //< 物体睡眠后渲染位置已经同步过
 	};
 }
 
@@ -0,0 +1,144 @@
+#include "DynamicBoxPool.h"
+
+#include <algorithm>
+
+#include "Profiler.h"
+#include "Utility.h"
+
+using namespace portal;
+
+namespace
+{
+	// 没用到的盒子先放在这里，它们不在物理世界里，位置其实无所谓
+	const glm::vec3 PARKING_POSITION{ 0.f, -10000.f, 0.f };
+}
+
+DynamicBoxPool::DynamicBoxPool( physics::Physics& physics, TextureInfo* texture, int capacity )
+	: mNextSlot( 0 )
+	, mNumActive( 0 )
+	, mIsPortalDetectionEnabled( true )
+	, mMesh( utility::generate_box_vertices( glm::vec3{ 0.f }, DynamicBox::SIZE, DynamicBox::SIZE, DynamicBox::SIZE, 1.f ), Renderer::INSTANCED_SHADER, texture )
+{
+	capacity = std::max( capacity, 1 );
+	mBoxes.reserve( capacity );
+	for( int i = 0; i < capacity; i++ )
+	{
+		mBoxes.push_back( std::make_unique<DynamicBox>( physics, PARKING_POSITION ) );
+		mBoxes.back()->GetCollisionBox().SetSimulated( false );
+	}
+	// 每个盒子最多还有一个克隆
+	mInstanceTransforms.reserve( capacity * 2 );
+}
+
+DynamicBoxPool::~DynamicBoxPool()
+{}
+
+DynamicBox&
+DynamicBoxPool::Spawn( glm::vec3 pos )
+{
+	DynamicBox& box = *mBoxes[ mNextSlot ];
+	mNextSlot = ( mNextSlot + 1 ) % static_cast<int>( mBoxes.size() );
+
+	auto& collision_box = box.GetCollisionBox();
+	if( !collision_box.IsSimulated() )
+	{
+		collision_box.SetSimulated( true );
+		box.SetPortalDetectionEnabled( mIsPortalDetectionEnabled );
+		mNumActive++;
+	}
+	box.Respawn( pos );
+	return box;
+}
+
+void
+DynamicBoxPool::SetPortalDetectionEnabled( bool enabled )
+{
+	mIsPortalDetectionEnabled = enabled;
+	for( auto& box : mBoxes )
+	{
+		box->SetPortalDetectionEnabled( enabled );
+	}
+}
+
+void
+DynamicBoxPool::Update()
+{
+	// 盒子按槽位顺序启用，前mNumActive个就是在用的
+	for( int i = 0; i < mNumActive; i++ )
+	{
+		mBoxes[i]->Update();
+	}
+}
+
+void
+DynamicBoxPool::UpdateClones()
+{
+	if( !mIsPortalDetectionEnabled )
+	{
+		return;
+	}
+	for( int i = 0; i < mNumActive; i++ )
+	{
+		mBoxes[i]->UpdateClone( mBoxes[i]->GetNearbyPortals() );
+	}
+}
+
+void
+DynamicBoxPool::Interpolate( float alpha )
+{
+	for( int i = 0; i < mNumActive; i++ )
+	{
+		mBoxes[i]->Interpolate( alpha );
+	}
+}
+
+void
+DynamicBoxPool::Render( Renderer& renderer )
+{
+	PORTAL_PROFILE_SCOPE( "DynamicBoxPool::Render" );
+	mInstanceTransforms.clear();
+	for( int i = 0; i < mNumActive; i++ )
+	{
+		mInstanceTransforms.push_back( mBoxes[i]->GetRenderTransform() );
+		if( mBoxes[i]->IsCloneVisible() )
+		{
+			mInstanceTransforms.push_back( mBoxes[i]->GetCloneRenderTransform() );
+		}
+	}
+	renderer.RenderInstanced( &mMesh, mInstanceTransforms );
+}
+
+int
+DynamicBoxPool::GetCapacity() const
+{
+	return static_cast<int>( mBoxes.size() );
+}
+
+DynamicBox&
+DynamicBoxPool::GetBox( int index )
+{
+	return *mBoxes[ index ];
+}
+
+int
+DynamicBoxPool::GetNumActive() const
+{
+	return mNumActive;
+}
+
+DynamicBoxPool::State
+DynamicBoxPool::GetState() const
+{
+	return { mNextSlot, mNumActive };
+}
+
+void
+DynamicBoxPool::RestoreState( const State& state )
+{
+	mNextSlot = state.next_slot;
+	mNumActive = state.num_active;
+	for( auto& box : mBoxes )
+	{
+		box->ResetRenderState();
+	}
+}
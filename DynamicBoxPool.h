@@ -0,0 +1,105 @@
+#ifndef _DYNAMIC_BOX_POOL_H
+#define _DYNAMIC_BOX_POOL_H
+
+#include <memory>
+#include <vector>
+
+#include "DynamicBox.h"
+#include "Renderer.h"
+
+namespace portal
+{
+	class Portal;
+
+	///
+	/// 固定容量的DynamicBox对象池
+	/// 所有盒子的刚体在创建时就准备好，没用到的移出物理世界；盒子用完了就回收最早发射的那个。
+	/// 所有盒子和它们的克隆共用一个模型，一次draw call实例化绘制
+	///
+	class DynamicBoxPool
+	{
+	public:
+		///
+		/// 对象池的状态，和物理快照一起保存
+		/// 盒子本身的位置、速度和是否在物理世界里由Physics::Snapshot保存
+		///
+		struct State
+		{
+			int next_slot;
+			int num_active;
+		};
+
+		///
+		/// 构造函数
+		///
+		/// @param physics
+		///		Reference to Physics
+		///
+		/// @param texture
+		///		盒子的贴图
+		///
+		/// @param capacity
+		///		最多同时存在的盒子数量
+		///
+		DynamicBoxPool( physics::Physics& physics, TextureInfo* texture, int capacity );
+		~DynamicBoxPool();
+
+		DynamicBoxPool( const DynamicBoxPool& ) = delete;
+		DynamicBoxPool& operator=( const DynamicBoxPool& ) = delete;
+
+		///
+		/// 在pos放一个静止的盒子，容量满了时回收最早的盒子
+		///
+		/// @return
+		///		放好的盒子，可以接着调用Launch()
+		///
+		DynamicBox& Spawn( glm::vec3 pos );
+
+		///
+		/// 关闭后传送门会忽略池里所有的盒子（压力测试用）
+		///
+		void SetPortalDetectionEnabled( bool enabled );
+
+		void Update();
+
+		///
+		/// 更新每个盒子在传送门出口的克隆，只检查盒子附近的传送门（见PortalSpatialHash）
+		///
+		void UpdateClones();
+
+		///
+		/// 见DynamicBox::Interpolate()
+		///
+		void Interpolate( float alpha );
+
+		///
+		/// 画出所有盒子和克隆，只有一次draw call
+		///
+		void Render( Renderer& renderer );
+
+		int GetCapacity() const;
+
+		///
+		/// 第index个盒子，包括还没用到的，登记到PortalSpatialHash用
+		///
+		DynamicBox& GetBox( int index );
+		int GetNumActive() const;
+
+		State GetState() const;
+
+		///
+		/// 在恢复物理快照之后调用
+		///
+		void RestoreState( const State& state );
+
+	private:
+		std::vector<std::unique_ptr<DynamicBox>> mBoxes;
+		int mNextSlot;                            ///< 下一个Spawn()使用的盒子，也就是最早的那个
+		int mNumActive;
+		bool mIsPortalDetectionEnabled;
+		Renderer::Renderable mMesh;
+		std::vector<glm::mat4> mInstanceTransforms; ///< 只是为了复用内存
+	};
+}
+
+#endif
@@ -0,0 +1,306 @@
+#include "GpuProfiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+#include <GL/glew.h>
+
+using namespace portal;
+
+namespace
+{
+	constexpr size_t INVALID_SCOPE = std::numeric_limits<size_t>::max();
+	constexpr size_t DEFAULT_HISTORY_SIZE = 600;
+	constexpr double NS_TO_MS = 1.0 / 1000000.0;
+}
+
+///
+/// Scope implementation
+///
+GpuProfiler::Scope::Scope( GpuProfiler& profiler, const char* name, int level )
+	: mProfiler( profiler )
+{
+	mProfiler.BeginScope( name, level );
+}
+
+GpuProfiler::Scope::~Scope()
+{
+	mProfiler.EndScope();
+}
+
+///
+/// GpuProfiler implementation
+///
+GpuProfiler::GpuProfiler( int latency_frames )
+	: mIsSupported( GLEW_VERSION_3_3 || GLEW_ARB_timer_query )
+	, mIsEnabled( false )
+	, mSlots( static_cast<size_t>( std::max( latency_frames, 2 ) ) )
+	, mCurrentSlot( nullptr )
+	, mFrameIndex( 0 )
+	, mSkippedFrames( 0 )
+	, mHistorySize( DEFAULT_HISTORY_SIZE )
+{
+	if( !mIsSupported )
+	{
+		std::cerr << "WARNING: GL timer queries are not supported, GPU profiling is disabled." << std::endl;
+		return;
+	}
+	for( auto& slot : mSlots )
+	{
+		glGenQueries( 1, &slot.elapsed_query );
+	}
+}
+
+GpuProfiler::~GpuProfiler()
+{
+	for( auto& slot : mSlots )
+	{
+		if( slot.elapsed_query )
+		{
+			glDeleteQueries( 1, &slot.elapsed_query );
+		}
+		if( !slot.query_pool.empty() )
+		{
+			glDeleteQueries( static_cast<GLsizei>( slot.query_pool.size() ), slot.query_pool.data() );
+		}
+	}
+}
+
+bool
+GpuProfiler::IsSupported() const
+{
+	return mIsSupported;
+}
+
+void
+GpuProfiler::SetEnabled( bool enabled )
+{
+	mIsEnabled = enabled && mIsSupported;
+}
+
+bool
+GpuProfiler::IsEnabled() const
+{
+	return mIsEnabled;
+}
+
+void
+GpuProfiler::BeginFrame()
+{
+	mScopeStack.clear();
+	mCurrentSlot = nullptr;
+	if( !mIsEnabled )
+	{
+		return;
+	}
+
+	CollectFinishedFrames();
+
+	FrameSlot& slot = mSlots[ mFrameIndex % mSlots.size() ];
+	if( slot.in_flight )
+	{
+		// GPU落后超过环形缓存的长度，宁可不记录这一帧也不等待
+		mSkippedFrames++;
+		return;
+	}
+
+	slot.frame_index = mFrameIndex;
+	slot.used_queries = 0;
+	slot.scopes.clear();
+	glBeginQuery( GL_TIME_ELAPSED, slot.elapsed_query );
+	mCurrentSlot = &slot;
+}
+
+void
+GpuProfiler::EndFrame()
+{
+	if( mCurrentSlot )
+	{
+		// 没有正确结束的渲染段在这里补上
+		while( !mScopeStack.empty() )
+		{
+			EndScope();
+		}
+		glEndQuery( GL_TIME_ELAPSED );
+		mCurrentSlot->in_flight = true;
+		mCurrentSlot = nullptr;
+	}
+	mFrameIndex++;
+}
+
+void
+GpuProfiler::BeginScope( const char* name, int level )
+{
+	if( !mCurrentSlot )
+	{
+		mScopeStack.push_back( INVALID_SCOPE );
+		return;
+	}
+
+	PendingScope scope{};
+	scope.name = name;
+	scope.level = level;
+	scope.depth = static_cast<int>( mScopeStack.size() );
+	scope.begin_query = AcquireQuery( *mCurrentSlot );
+	scope.end_query = AcquireQuery( *mCurrentSlot );
+	glQueryCounter( scope.begin_query, GL_TIMESTAMP );
+
+	mScopeStack.push_back( mCurrentSlot->scopes.size() );
+	mCurrentSlot->scopes.push_back( scope );
+}
+
+void
+GpuProfiler::EndScope()
+{
+	if( mScopeStack.empty() )
+	{
+		return;
+	}
+	const size_t index = mScopeStack.back();
+	mScopeStack.pop_back();
+	if( mCurrentSlot && index != INVALID_SCOPE )
+	{
+		glQueryCounter( mCurrentSlot->scopes[ index ].end_query, GL_TIMESTAMP );
+	}
+}
+
+const GpuProfiler::FrameResult*
+GpuProfiler::GetLatestResult() const
+{
+	if( mHistory.empty() )
+	{
+		return nullptr;
+	}
+	return &mHistory.back();
+}
+
+const std::deque<GpuProfiler::FrameResult>&
+GpuProfiler::GetHistory() const
+{
+	return mHistory;
+}
+
+void
+GpuProfiler::SetHistorySize( size_t num_frames )
+{
+	mHistorySize = std::max<size_t>( num_frames, 1 );
+	while( mHistory.size() > mHistorySize )
+	{
+		mHistory.pop_front();
+	}
+}
+
+uint64_t
+GpuProfiler::GetSkippedFrames() const
+{
+	return mSkippedFrames;
+}
+
+void
+GpuProfiler::WriteCSV( std::ostream& os ) const
+{
+	os << "frame,name,level,depth,start_ms,duration_ms,frame_ms\n";
+	for( auto& frame : mHistory )
+	{
+		for( auto& scope : frame.scopes )
+		{
+			os << frame.frame_index << ','
+			   << scope.name << ','
+			   << scope.level << ','
+			   << scope.depth << ','
+			   << scope.start_ms << ','
+			   << scope.duration_ms << ','
+			   << frame.frame_ms << '\n';
+		}
+	}
+}
+
+bool
+GpuProfiler::SaveCSV( const std::string& path ) const
+{
+	std::ofstream ofs{ path };
+	if( !ofs.is_open() )
+	{
+		std::cerr << "ERROR: Failed to open GPU profile file " << path << std::endl;
+		return false;
+	}
+	WriteCSV( ofs );
+	return true;
+}
+
+unsigned int
+GpuProfiler::AcquireQuery( FrameSlot& slot )
+{
+	if( slot.used_queries == slot.query_pool.size() )
+	{
+		unsigned int query = 0;
+		glGenQueries( 1, &query );
+		slot.query_pool.push_back( query );
+	}
+	return slot.query_pool[ slot.used_queries++ ];
+}
+
+void
+GpuProfiler::CollectFinishedFrames()
+{
+	// 从最老的帧开始回读，保证历史记录按帧顺序排列
+	for( size_t i = 0; i < mSlots.size(); i++ )
+	{
+		FrameSlot& slot = mSlots[ ( mFrameIndex + i ) % mSlots.size() ];
+		if( slot.in_flight && IsSlotReady( slot ) )
+		{
+			ReadSlot( slot );
+		}
+	}
+}
+
+bool
+GpuProfiler::IsSlotReady( const FrameSlot& slot ) const
+{
+	// 查询按提交顺序完成，整帧的查询最后结束，它可用时其他查询也可用了
+	GLint available = 0;
+	glGetQueryObjectiv( slot.elapsed_query, GL_QUERY_RESULT_AVAILABLE, &available );
+	return available != 0;
+}
+
+void
+GpuProfiler::ReadSlot( FrameSlot& slot )
+{
+	FrameResult result;
+	result.frame_index = slot.frame_index;
+
+	GLuint64 elapsed = 0;
+	glGetQueryObjectui64v( slot.elapsed_query, GL_QUERY_RESULT, &elapsed );
+	result.frame_ms = static_cast<double>( elapsed ) * NS_TO_MS;
+
+	result.scopes.reserve( slot.scopes.size() );
+	GLuint64 frame_start = 0;
+	for( size_t i = 0; i < slot.scopes.size(); i++ )
+	{
+		const PendingScope& scope = slot.scopes[i];
+		GLuint64 begin = 0;
+		GLuint64 end = 0;
+		glGetQueryObjectui64v( scope.begin_query, GL_QUERY_RESULT, &begin );
+		glGetQueryObjectui64v( scope.end_query, GL_QUERY_RESULT, &end );
+		if( i == 0 )
+		{
+			frame_start = begin;
+		}
+		result.scopes.push_back( {
+			scope.name,
+			scope.level,
+			scope.depth,
+			static_cast<double>( begin - frame_start ) * NS_TO_MS,
+			static_cast<double>( end > begin ? end - begin : 0 ) * NS_TO_MS
+		} );
+	}
+	slot.in_flight = false;
+
+	mHistory.push_back( std::move( result ) );
+	while( mHistory.size() > mHistorySize )
+	{
+		mHistory.pop_front();
+	}
+}
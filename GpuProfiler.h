@@ -0,0 +1,163 @@
+#ifndef _GPU_PROFILER_H
+#define _GPU_PROFILER_H
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <ostream>
+#include <cstdint>
+
+namespace portal
+{
+	///
+	/// GPU计时器
+	/// 用GL_TIMESTAMP查询记录每个渲染段的起止时间，GL_TIME_ELAPSED记录整帧时间。
+	/// GL_TIME_ELAPSED查询不能嵌套，所以渲染段统一用时间戳来实现嵌套。
+	///
+	/// 查询结果会延迟几帧才回读（环形缓存），只在结果已经可用时读取，不会让CPU等待GPU。
+	/// 只能在获取OpenGL Context后使用
+	///
+	class GpuProfiler
+	{
+	public:
+		///
+		/// 一个渲染段的计时结果
+		///
+		struct ScopeResult
+		{
+			const char* name;   ///< 渲染段名字
+			int level;          ///< 传送门递归层数，-1表示不相关
+			int depth;          ///< 嵌套深度，0为最外层
+			double start_ms;    ///< 相对于本帧第一个渲染段开始的时间
+			double duration_ms; ///< GPU耗时
+		};
+
+		///
+		/// 一帧的计时结果
+		///
+		struct FrameResult
+		{
+			uint64_t frame_index;
+			double frame_ms;                 ///< 整帧GPU耗时
+			std::vector<ScopeResult> scopes; ///< 按开始顺序排列
+		};
+
+		///
+		/// RAII渲染段，构造时开始计时，析构时结束
+		///
+		class Scope
+		{
+		public:
+			Scope( GpuProfiler& profiler, const char* name, int level = -1 );
+			~Scope();
+
+			Scope( const Scope& ) = delete;
+			Scope& operator=( const Scope& ) = delete;
+
+		private:
+			GpuProfiler& mProfiler;
+		};
+
+		///
+		/// 构造函数
+		///
+		/// @param latency_frames
+		///		环形缓存的帧数，也就是结果最多延迟几帧回读
+		///
+		GpuProfiler( int latency_frames = 4 );
+		~GpuProfiler();
+
+		///
+		/// 当前OpenGL Context是否支持计时查询
+		///
+		bool IsSupported() const;
+
+		void SetEnabled( bool enabled );
+		bool IsEnabled() const;
+
+		///
+		/// 一帧的开始和结束，渲染段必须在这两者之间
+		///
+		void BeginFrame();
+		void EndFrame();
+
+		///
+		/// 开始和结束一个渲染段，可以嵌套
+		///
+		/// @param name
+		///		渲染段名字，必须是静态字符串
+		///
+		/// @param level
+		///		传送门递归层数
+		///
+		void BeginScope( const char* name, int level = -1 );
+		void EndScope();
+
+		///
+		/// 获取最近一帧已回读的结果
+		///
+		/// @return
+		///		还没有任何结果时返回nullptr
+		///
+		const FrameResult* GetLatestResult() const;
+
+		///
+		/// 已回读的历史结果，最多保留SetHistorySize()帧
+		///
+		const std::deque<FrameResult>& GetHistory() const;
+		void SetHistorySize( size_t num_frames );
+
+		///
+		/// 因为GPU落后太多而没有记录的帧数
+		///
+		uint64_t GetSkippedFrames() const;
+
+		///
+		/// 把历史结果导出为CSV
+		/// 格式：frame,name,level,depth,start_ms,duration_ms,frame_ms
+		///
+		void WriteCSV( std::ostream& os ) const;
+		bool SaveCSV( const std::string& path ) const;
+
+	private:
+		struct PendingScope
+		{
+			const char* name;
+			int level;
+			int depth;
+			unsigned int begin_query;
+			unsigned int end_query;
+		};
+
+		struct FrameSlot
+		{
+			bool in_flight = false;
+			uint64_t frame_index = 0;
+			unsigned int elapsed_query = 0;
+			std::vector<unsigned int> query_pool; ///< 可重复使用的时间戳查询
+			size_t used_queries = 0;
+			std::vector<PendingScope> scopes;
+		};
+
+		unsigned int AcquireQuery( FrameSlot& slot );
+
+		///
+		/// 回读所有已经完成的帧，不会阻塞
+		///
+		void CollectFinishedFrames();
+		bool IsSlotReady( const FrameSlot& slot ) const;
+		void ReadSlot( FrameSlot& slot );
+
+		bool mIsSupported;
+		bool mIsEnabled;
+		std::vector<FrameSlot> mSlots;
+		FrameSlot* mCurrentSlot;      ///< 正在记录的帧，nullptr表示本帧不记录
+		std::vector<size_t> mScopeStack;
+		uint64_t mFrameIndex;
+		uint64_t mSkippedFrames;
+		std::deque<FrameResult> mHistory;
+		size_t mHistorySize;
+	};
+}
+
+#endif
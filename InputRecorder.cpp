@@ -0,0 +1,173 @@
+#include "InputRecorder.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+using namespace portal;
+
+namespace
+{
+	constexpr char FILE_MAGIC[4] = { 'P', 'I', 'N', 'P' };
+	constexpr uint32_t FILE_VERSION = 1;
+	constexpr size_t EVENT_SIZE = 12;
+
+	void
+	write_u32( std::ostream& os, uint32_t value )
+	{
+		const char bytes[4] = {
+			static_cast<char>( value & 0xff ),
+			static_cast<char>( ( value >> 8 ) & 0xff ),
+			static_cast<char>( ( value >> 16 ) & 0xff ),
+			static_cast<char>( ( value >> 24 ) & 0xff )
+		};
+		os.write( bytes, sizeof( bytes ) );
+	}
+
+	uint32_t
+	read_u32( const unsigned char* bytes )
+	{
+		return static_cast<uint32_t>( bytes[0] ) |
+			   static_cast<uint32_t>( bytes[1] ) << 8 |
+			   static_cast<uint32_t>( bytes[2] ) << 16 |
+			   static_cast<uint32_t>( bytes[3] ) << 24;
+	}
+
+	int16_t
+	read_i16( const unsigned char* bytes )
+	{
+		return static_cast<int16_t>( static_cast<uint16_t>( bytes[0] ) | static_cast<uint16_t>( bytes[1] ) << 8 );
+	}
+}
+
+InputRecorder::InputRecorder( unsigned int update_interval_ms )
+	: mUpdateIntervalMs( update_interval_ms )
+{
+}
+
+void
+InputRecorder::Record( const InputEvent& event )
+{
+	mEvents.push_back( event );
+}
+
+bool
+InputRecorder::Save( const std::string& path, uint32_t tick_count ) const
+{
+	std::ofstream ofs{ path, std::ios::binary };
+	if( !ofs.is_open() )
+	{
+		std::cerr << "ERROR: Failed to open input recording " << path << std::endl;
+		return false;
+	}
+
+	ofs.write( FILE_MAGIC, sizeof( FILE_MAGIC ) );
+	write_u32( ofs, FILE_VERSION );
+	write_u32( ofs, mUpdateIntervalMs );
+	write_u32( ofs, tick_count );
+	write_u32( ofs, static_cast<uint32_t>( mEvents.size() ) );
+	for( auto& event : mEvents )
+	{
+		const uint16_t x = static_cast<uint16_t>( event.x );
+		const uint16_t y = static_cast<uint16_t>( event.y );
+		write_u32( ofs, event.tick );
+		const char bytes[8] = {
+			static_cast<char>( event.type ),
+			static_cast<char>( event.code ),
+			static_cast<char>( event.is_down ? 1 : 0 ),
+			0,
+			static_cast<char>( x & 0xff ),
+			static_cast<char>( x >> 8 ),
+			static_cast<char>( y & 0xff ),
+			static_cast<char>( y >> 8 )
+		};
+		ofs.write( bytes, sizeof( bytes ) );
+	}
+	return ofs.good();
+}
+
+InputReplay::InputReplay()
+	: mNextEvent( 0 )
+	, mTickCount( 0 )
+{
+}
+
+bool
+InputReplay::Load( const std::string& path, unsigned int update_interval_ms )
+{
+	std::ifstream ifs{ path, std::ios::binary };
+	if( !ifs.is_open() )
+	{
+		std::cerr << "ERROR: Failed to open input recording " << path << std::endl;
+		return false;
+	}
+
+	unsigned char header[20];
+	if( !ifs.read( reinterpret_cast<char*>( header ), sizeof( header ) ) ||
+		!std::equal( std::begin( FILE_MAGIC ), std::end( FILE_MAGIC ), header ) )
+	{
+		std::cerr << "ERROR: " << path << " is not an input recording" << std::endl;
+		return false;
+	}
+
+	const uint32_t version = read_u32( header + 4 );
+	if( version != FILE_VERSION )
+	{
+		std::cerr << "ERROR: Unsupported input recording version " << version << std::endl;
+		return false;
+	}
+
+	const uint32_t recorded_interval_ms = read_u32( header + 8 );
+	if( recorded_interval_ms != update_interval_ms )
+	{
+		std::cerr << "WARNING: Input recording was made with " << recorded_interval_ms << "ms updates, current is " << update_interval_ms << "ms. Replay will diverge." << std::endl;
+	}
+	mTickCount = read_u32( header + 12 );
+	const uint32_t num_events = read_u32( header + 16 );
+
+	mEvents.clear();
+	mEvents.reserve( num_events );
+	unsigned char bytes[EVENT_SIZE];
+	for( uint32_t i = 0; i < num_events; i++ )
+	{
+		if( !ifs.read( reinterpret_cast<char*>( bytes ), sizeof( bytes ) ) )
+		{
+			std::cerr << "ERROR: Input recording " << path << " is truncated" << std::endl;
+			return false;
+		}
+		InputEvent event;
+		event.tick = read_u32( bytes );
+		event.type = static_cast<InputEvent::Type>( bytes[4] );
+		event.code = bytes[5];
+		event.is_down = bytes[6] != 0;
+		event.x = read_i16( bytes + 8 );
+		event.y = read_i16( bytes + 10 );
+		mEvents.push_back( event );
+	}
+	mNextEvent = 0;
+	return true;
+}
+
+void
+InputReplay::Feed( uint32_t tick, const std::function<void( const InputEvent& )>& handler )
+{
+	// 录制时事件按时间顺序写入，tick不会减小
+	while( mNextEvent < mEvents.size() && mEvents[ mNextEvent ].tick <= tick )
+	{
+		handler( mEvents[ mNextEvent ] );
+		mNextEvent++;
+	}
+}
+
+bool
+InputReplay::IsFinished( uint32_t tick ) const
+{
+	return tick >= mTickCount;
+}
+
+uint32_t
+InputReplay::GetTickCount() const
+{
+	return mTickCount;
+}
@@ -0,0 +1,119 @@
+#ifndef _INPUT_RECORDER_H
+#define _INPUT_RECORDER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+
+namespace portal
+{
+	///
+	/// 一个输入事件
+	/// tick是事件之后第一次游戏逻辑更新的序号，回放时在这次更新之前按原顺序重新派发
+	///
+	struct InputEvent
+	{
+		enum class Type : uint8_t
+		{
+			KEY,          //< 键盘，code是ASCII
+			MOUSE_MOVE,   //< 鼠标移动，x, y是窗口坐标
+			MOUSE_BUTTON  //< 鼠标按键，code是GLUT的按键编号
+		};
+
+		uint32_t tick;
+		Type type;
+		uint8_t code;
+		bool is_down;
+		int16_t x;
+		int16_t y;
+	};
+
+	///
+	/// 录制输入事件并保存为二进制文件
+	///
+	/// 文件格式（小端）：
+	///		文件头 "PINP" | uint32 版本 | uint32 更新间隔（毫秒） | uint32 总更新次数 | uint32 事件数量
+	///		每个事件12字节 uint32 tick | uint8 type | uint8 code | uint8 is_down | uint8 保留 | int16 x | int16 y
+	///
+	class InputRecorder
+	{
+	public:
+		///
+		/// 构造函数
+		///
+		/// @param update_interval_ms
+		///		游戏逻辑更新间隔，回放时用来检查是否一致
+		///
+		InputRecorder( unsigned int update_interval_ms );
+
+		void Record( const InputEvent& event );
+
+		///
+		/// 保存到文件
+		///
+		/// @param path
+		///		文件路径
+		///
+		/// @param tick_count
+		///		录制期间游戏逻辑一共更新了多少次
+		///
+		/// @return
+		///		True表示成功
+		///
+		bool Save( const std::string& path, uint32_t tick_count ) const;
+
+	private:
+		unsigned int mUpdateIntervalMs;
+		std::vector<InputEvent> mEvents;
+	};
+
+	///
+	/// 读取InputRecorder保存的文件，并按更新序号回放事件
+	/// 配合固定的物理步长，同一段录像每次回放的结果都是一样的
+	///
+	class InputReplay
+	{
+	public:
+		InputReplay();
+
+		///
+		/// 读取录像文件
+		///
+		/// @param path
+		///		文件路径
+		///
+		/// @param update_interval_ms
+		///		当前的游戏逻辑更新间隔，和录制时不一致会给出警告
+		///
+		/// @return
+		///		True表示成功
+		///
+		bool Load( const std::string& path, unsigned int update_interval_ms );
+
+		///
+		/// 派发属于这次更新的所有事件，每次游戏逻辑更新之前调用
+		///
+		/// @param tick
+		///		当前更新的序号，必须递增
+		///
+		/// @param handler
+		///		处理事件的函数
+		///
+		void Feed( uint32_t tick, const std::function<void( const InputEvent& )>& handler );
+
+		///
+		/// 录像是否已经回放完
+		///
+		bool IsFinished( uint32_t tick ) const;
+
+		uint32_t GetTickCount() const;
+
+	private:
+		std::vector<InputEvent> mEvents;
+		size_t mNextEvent;
+		uint32_t mTickCount;
+	};
+}
+
+#endif
@@ -3,19 +3,28 @@
 #include <GL/glew.h>
 #include <rapidjson/document.h>
 #include <rapidjson/istreamwrapper.h>
+#include <algorithm>
 #include <string>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <random>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 
 #include "ScenePrimitives.h"
 #include "Renderer.h"
+#include "DebugRenderer.h"
 #include "Camera.h"
 #include "Portal.h"
+#include "PortalGraph.h"
+#include "PortalSpatialHash.h"
 #include "LevelConstants.h"
 #include "Utility.h"
-#include "DynamicBox.h"
+#include "DynamicBoxPool.h"
 #include "Player.h"
+#include "GpuProfiler.h"
+#include "Profiler.h"
 
 using namespace portal;
 using namespace portal::physics;
@@ -26,8 +35,23 @@ namespace
 	constexpr int PORTAL_1 = 0;
 	constexpr int PORTAL_2 = 1;
 	const int MAX_PORTAL_RECURSION = 5;
+	const int MAX_PORTAL_VIEWS = 128; // 递归渲染的节点上限，一对传送门正好可以展开到MAX_PORTAL_RECURSION层
+	const glm::ivec2 HEADLESS_VIEWPORT_SIZE{ 1280, 720 }; // 无头模式没有视口，摄像机按这个宽高比
+	const float WORLD_BOUNDS_MARGIN = 100.f; // 世界边界在墙的范围外留的余量，发射出去的盒子和跳起来的玩家不会马上出界
+	const float PORTAL_HASH_CELL_SIZE = 32.f; // 比传送门的触发区大一点
 }
 
+///
+/// 关卡的快照，物体的状态都在Physics::Snapshot里，这里只有物理之外的部分
+/// 
+struct LevelController::Snapshot
+{
+	physics::Physics::Snapshot physics;
+	std::vector<Portal::Placement> portals; ///< 按PortalGraph里的序号
+	DynamicBoxPool::State box_pool;
+	DynamicBoxPool::State stress_boxes;
+};
+
 ///
 /// Level class implementations
 /// 
@@ -60,15 +84,34 @@ LevelController::Level::GetSpawn() const
 	return mSpawnPoint;
 }
 
+void
+LevelController::Level::AddPortalPair( PortalPair pair )
+{
+	mPortalPairs.push_back( std::move( pair ) );
+}
+
+const std::vector<LevelController::Level::PortalPair>&
+LevelController::Level::GetPortalPairs() const
+{
+	return mPortalPairs;
+}
+
 ///
 /// LevelController implementations
 /// 
-LevelController::LevelController( Renderer& renderer )
+LevelController::LevelController( Renderer* renderer )
 	: mRenderer( renderer )
 	, mMouseX( 0 )
 	, mMouseY( 0 )
+	, mPortalHashVersion( 0 )
 	, mCurrentLevel( nullptr )
 	, mMainCamProjMat( glm::mat4( 1.f ) )
+	, mBoxPoolCapacity( 16 )
+	, mShootBoxToggle( false )
+	, mRestartToggle( false )
+	, mUpdateInterval( 0.f )
+	, mIsDeterministic( false )
+	, mIsCameraScripted( false )
 {
 }
 
@@ -77,10 +120,16 @@ LevelController::~LevelController()
 }
 
 void
-LevelController::Initialize( int update_interval_ms )
+LevelController::Initialize( int update_interval_ms, const physics::Settings& physics_settings )
 {
-	mPhysics = std::make_unique<Physics>( mRenderer );
-	mPhysics->Initialize( update_interval_ms / 1000.f );
+	mUpdateInterval = update_interval_ms / 1000.f;
+	mPhysics = std::make_unique<Physics>();
+	mPhysics->Initialize( mUpdateInterval, physics_settings );
+	if( mRenderer )
+	{
+		mPhysicsDebugRenderer = std::make_unique<DebugRenderer>( *mRenderer );
+		mPhysics->SetDebugDrawer( mPhysicsDebugRenderer.get() );
+	}
 }
 
 bool 
@@ -161,13 +210,38 @@ LevelController::LoadLevelFile( const std::string& path )
 			}
 		}
 	}
+
+	if( json_doc.HasMember( "Portals" ) )
+	{
+		// "Portals": [ { "a": { "from": {...}, "to": {...} }, "b": { ... } }, ... ]
+		auto read_vec3 = []( const rapidjson::Value& value )
+		{
+			return glm::vec3{ value[ "x" ].GetFloat(), value[ "y" ].GetFloat(), value[ "z" ].GetFloat() };
+		};
+		for( auto& pair_obj : json_doc[ "Portals" ].GetArray() )
+		{
+			if( !pair_obj.HasMember( "a" ) || !pair_obj.HasMember( "b" ) )
+			{
+				std::cerr << "WARNING: Portal pair in level " << path << " needs both \"a\" and \"b\", skipped." << std::endl;
+				continue;
+			}
+			Level::PortalPair pair;
+			const char* ends[] = { "a", "b" };
+			for( int i = 0; i < 2; i++ )
+			{
+				pair.from[i] = read_vec3( pair_obj[ ends[i] ][ "from" ] );
+				pair.to[i] = read_vec3( pair_obj[ ends[i] ][ "to" ] );
+			}
+			level->AddPortalPair( std::move( pair ) );
+		}
+	}
 	mLevels[ path ] = std::move( level );
 
 	return true;
 }
 
 void 
-LevelController::ChangeLevelTo( const std::string& path )
+LevelController::ChangeLevelTo( const std::string& path, bool bake_static_walls )
 {
 	auto itr = mLevels.find( path );
 	if( itr == mLevels.end() )
@@ -179,8 +253,24 @@ LevelController::ChangeLevelTo( const std::string& path )
 	// TODO: Release the previous level
 	mCurrentLevel = itr->second.get();
 
+	// 关卡是有边界的盒子，用墙的范围作为broadphase的世界边界
+	auto& walls = mCurrentLevel->GetWalls();
+	if( !walls.empty() )
+	{
+		AABB bounds{ glm::vec3{ std::numeric_limits<float>::lowest() }, glm::vec3{ std::numeric_limits<float>::max() } };
+		for( auto& wall : walls )
+		{
+			const glm::vec3 half_size = glm::vec3{ wall.width, wall.height, wall.depth } * 0.5f;
+			bounds.min = glm::min( bounds.min, wall.position - half_size );
+			bounds.max = glm::max( bounds.max, wall.position + half_size );
+		}
+		bounds.min -= glm::vec3{ WORLD_BOUNDS_MARGIN };
+		bounds.max += glm::vec3{ WORLD_BOUNDS_MARGIN };
+		mPhysics->SetWorldBounds( bounds );
+	}
+
 	// 改变玩家出生点
-	auto view_size = mRenderer.GetViewportSize();
+	auto view_size = mRenderer ? mRenderer->GetViewportSize() : HEADLESS_VIEWPORT_SIZE;
 	const float view_width = static_cast<float>( view_size.x );
 	const float view_height = static_cast<float>( view_size.y );
 	mMainCamera = std::make_shared<Camera>( view_width, view_height );
@@ -188,25 +278,46 @@ LevelController::ChangeLevelTo( const std::string& path )
 	mPlayer = std::make_unique<Player>( *mPhysics );
 	mPlayer->Spawn( mCurrentLevel->GetSpawn(), mMainCamera );
 
-	mSkybox = std::make_unique<SceneSkyBox>( mRenderer.GetResources().GetTextureInfo( "SKYBOX" ) );
-	mSkybox->Rotate( glm::radians( 100.f ), { 0.f, 1.f, 0.f } );
-	mPortals[PORTAL_1] = std::make_unique<Portal>( mRenderer.GetResources().GetTextureInfo( "resources/textures/blueportal.png" ), *mPhysics );
-	mPortals[PORTAL_2] = std::make_unique<Portal>( mRenderer.GetResources().GetTextureInfo( "resources/textures/orangeportal.png" ), *mPhysics );
-	mPortals[PORTAL_1]->SetPair( mPortals[PORTAL_2].get() );
-	mPortals[PORTAL_2]->SetPair( mPortals[PORTAL_1].get() );
+	if( mRenderer )
+	{
+		mSkybox = std::make_unique<SceneSkyBox>( GetTexture( "SKYBOX" ) );
+		mSkybox->Rotate( glm::radians( 100.f ), { 0.f, 1.f, 0.f } );
+	}
+	// 第0对传送门给玩家，关卡里的传送门对等墙建好后再放
+	TextureInfo* portal_textures[2] = {
+		GetTexture( "resources/textures/blueportal.png" ),
+		GetTexture( "resources/textures/orangeportal.png" )
+	};
+	auto& portal_pairs = mCurrentLevel->GetPortalPairs();
+	mPortalGraph = std::make_unique<PortalGraph>();
+	for( size_t i = 0; i < portal_pairs.size() + 1; i++ )
+	{
+		mPortalGraph->AddPair(
+			std::make_unique<Portal>( portal_textures[PORTAL_1], *mPhysics ),
+			std::make_unique<Portal>( portal_textures[PORTAL_2], *mPhysics )
+		);
+	}
 
 	// 根据关卡数据生成静态物体
-	auto& walls = mCurrentLevel->GetWalls();
+	std::vector<Physics::StaticCompound::Part> baked_walls;
 	for( auto& wall : walls )
 	{
-		wall.render_instance = std::make_unique<SceneBox>(
-			wall.position,
-			wall.width,
-			wall.height,
-			wall.depth,
-			wall.shader_name,
-			mRenderer.GetResources().GetTextureInfo( wall.texture_path )
-		);
+		if( mRenderer )
+		{
+			wall.render_instance = std::make_unique<SceneBox>(
+				wall.position,
+				wall.width,
+				wall.height,
+				wall.depth,
+				wall.shader_name,
+				GetTexture( wall.texture_path )
+			);
+		}
+		if( bake_static_walls )
+		{
+			baked_walls.push_back( { wall.position, { wall.width, wall.height, wall.depth } } );
+			continue;
+		}
 		wall.mCollisionBox = mPhysics->CreateBox( 
 			wall.position, 
 			{ wall.width, wall.height, wall.depth }, 
@@ -215,43 +326,257 @@ LevelController::ChangeLevelTo( const std::string& path )
 			static_cast<int>( PhysicsGroup::PLAYER ) | static_cast<int>( PhysicsGroup::RAY )
 		);
 	}
-	mRenderer.UseCameraMatrix( mMainCamera.get() );
-	mDyBox = std::make_unique<DynamicBox>( 
+	mStaticWalls.reset();
+	if( bake_static_walls )
+	{
+		// 传送门放到的墙会被单独拆出来，见Physics::ResolveAttachSurface()
+		mStaticWalls = mPhysics->CreateStaticCompound(
+			std::move( baked_walls ),
+			static_cast<int>( PhysicsGroup::WALL ),
+			static_cast<int>( PhysicsGroup::PLAYER ) | static_cast<int>( PhysicsGroup::RAY )
+		);
+	}
+	for( size_t i = 0; i < portal_pairs.size(); i++ )
+	{
+		for( int k = PORTAL_1; k <= PORTAL_2; k++ )
+		{
+			const int index = static_cast<int>( 2 * ( i + 1 ) ) + k;
+			if( !PlacePortal( index, portal_pairs[i].from[k], portal_pairs[i].to[k] ) )
+			{
+				std::cerr << "WARNING: Failed to place portal " << index << " of level " << path << ", the ray hit no wall." << std::endl;
+			}
+		}
+	}
+	if( mRenderer )
+	{
+		mRenderer->UseCameraMatrix( mMainCamera.get() );
+	}
+	mBoxPool = std::make_unique<DynamicBoxPool>( 
 		*mPhysics,
-		glm::vec3{ 0.f, 30.f, 0.f },
-		mRenderer.GetResources().GetTextureInfo( "resources/textures/box.jpg" )
+		GetTexture( "resources/textures/box.jpg" ),
+		mBoxPoolCapacity
 	);
+	mBoxPool->Spawn( glm::vec3{ 0.f, 30.f, 0.f } );
+
+	// 压力测试的盒子关闭了传送门检测，不用登记
+	mPortalSpatialHash = std::make_unique<PortalSpatialHash>( PORTAL_HASH_CELL_SIZE );
+	mPortalSpatialHash->AddPortalable( mPlayer.get() );
+	for( int i = 0; i < mBoxPool->GetCapacity(); i++ )
+	{
+		mPortalSpatialHash->AddPortalable( &mBoxPool->GetBox( i ) );
+	}
+	mPortalSpatialHash->Rebuild( mPortalGraph->GetPlacedPortals() );
+	mPortalHashVersion = mPortalGraph->GetPlacementVersion();
+
+	mLevelStartSnapshot = std::make_unique<Snapshot>();
+	SaveSnapshot( *mLevelStartSnapshot );
 }
 
 void
 LevelController::Update()
 {
+	PORTAL_PROFILE_SCOPE( "LevelController::Update" );
 	if( mPlayer )
 	{
+		PORTAL_PROFILE_SCOPE( "Player::Update" );
 		mPlayer->Update();
 	}
 	if( mPhysics )
 	{
-		mPhysics->Update();
+		if( mIsDeterministic )
+		{
+			mPhysics->Step( mUpdateInterval );
+		}
+		else
+		{
+			mPhysics->Update();
+		}
+	}
+
+	{
+		PORTAL_PROFILE_SCOPE( "LevelController::CheckPortals" );
+		if( mPortalHashVersion != mPortalGraph->GetPlacementVersion() )
+		{
+			mPortalSpatialHash->Rebuild( mPortalGraph->GetPlacedPortals() );
+			mPortalHashVersion = mPortalGraph->GetPlacementVersion();
+		}
+		// 把物体交给它附近的传送门，没放置的传送门不用检查
+		mPortalSpatialHash->Update();
+		for( Portal* portal : mPortalGraph->GetPlacedPortals() )
+		{
+			portal->Update();
+		}
+		mBoxPool->UpdateClones();
+	}
+
+	mBoxPool->Update();
+	if( mStressBoxes )
+	{
+		mStressBoxes->Update();
 	}
+}
+
+void
+LevelController::SetBoxPoolCapacity( int capacity )
+{
+	mBoxPoolCapacity = std::max( capacity, 1 );
+}
 
-	for( auto& portal : mPortals )
+void
+LevelController::SetDeterministic( bool deterministic )
+{
+	mIsDeterministic = deterministic;
+}
+
+bool
+LevelController::PlacePortal( int index, glm::vec3 from, glm::vec3 to )
+{
+	Portal* portal = mPortalGraph ? mPortalGraph->GetPortal( index ) : nullptr;
+	if( !portal )
 	{
-		portal->CheckPortalable( mPlayer.get() );
-		portal->CheckPortalable( mDyBox.get() );
-		if( portal->IsPortalableEntering( mDyBox.get() ) )
+		return false;
+	}
+
+	bool is_placed = false;
+	mPhysics->CastRay(
+		from, to,
+		static_cast<int>( PhysicsGroup::RAY ),
+		[&]( bool is_hit, glm::vec3 hit_point, glm::vec3 hit_normal, const btCollisionObject* obj, int child_index )
 		{
-			// Clone!
-			mDyBox->CloneAt( *portal );
-			mRenderClone = true;
+			if( is_hit )
+			{
+				is_placed = portal->PlaceAt( hit_point, hit_normal, obj );
+				if( is_placed )
+				{
+					portal->SetAttachedCollisionObject( mPhysics->ResolveAttachSurface( obj, child_index ) );
+				}
+			}
 		}
+	);
+	return is_placed;
+}
+
+void
+LevelController::RemovePortal( int index )
+{
+	Portal* portal = mPortalGraph ? mPortalGraph->GetPortal( index ) : nullptr;
+	if( portal )
+	{
+		portal->Remove();
 	}
-	if( !mPortals[PORTAL_1]->IsPortalableEntering( mDyBox.get() ) && !mPortals[PORTAL_2]->IsPortalableEntering( mDyBox.get() ) )
+}
+
+int
+LevelController::GetNumPortals() const
+{
+	return mPortalGraph ? mPortalGraph->GetNumPortals() : 0;
+}
+
+void
+LevelController::SetCameraPose( glm::vec3 position, glm::vec3 target )
+{
+	if( mMainCamera )
 	{
-		mRenderClone = false;
+		mIsCameraScripted = true;
+		mMainCamera->SetPosition( std::move( position ) );
+		mMainCamera->SetTarget( std::move( target ) );
 	}
+}
 
-	mDyBox->Update();
+physics::Physics&
+LevelController::GetPhysics()
+{
+	return *mPhysics.get();
+}
+
+void
+LevelController::SpawnStressBoxes( int count )
+{
+	// 固定种子，每次测试的场景都一样
+	std::mt19937 random( 20220213 );
+	std::uniform_real_distribution<float> horizontal_force( -3000.f, 3000.f );
+	std::uniform_real_distribution<float> vertical_force( 0.f, 2000.f );
+
+	constexpr int BOXES_PER_ROW = 8;
+	constexpr float BOX_SPACING = 6.f;
+	mStressBoxes = std::make_unique<DynamicBoxPool>(
+		*mPhysics,
+		GetTexture( "resources/textures/box.jpg" ),
+		count
+	);
+	mStressBoxes->SetPortalDetectionEnabled( false );
+	for( int i = 0; i < count; i++ )
+	{
+		// 在出生点上空一层一层往上堆
+		const int layer = i / ( BOXES_PER_ROW * BOXES_PER_ROW );
+		const int row = ( i / BOXES_PER_ROW ) % BOXES_PER_ROW;
+		const int column = i % BOXES_PER_ROW;
+		const glm::vec3 pos = mCurrentLevel->GetSpawn() + glm::vec3{
+			( column - BOXES_PER_ROW / 2 ) * BOX_SPACING,
+			20.f + layer * BOX_SPACING,
+			( row - BOXES_PER_ROW / 2 ) * BOX_SPACING
+		};
+
+		mStressBoxes->Spawn( pos ).Launch( { horizontal_force( random ), vertical_force( random ), horizontal_force( random ) } );
+	}
+
+	// 重新开始时盒子也要回到刚发射的状态
+	if( mLevelStartSnapshot )
+	{
+		SaveSnapshot( *mLevelStartSnapshot );
+	}
+}
+
+bool
+LevelController::RestartLevel()
+{
+	if( !mLevelStartSnapshot )
+	{
+		return false;
+	}
+	PORTAL_PROFILE_SCOPE( "LevelController::RestartLevel" );
+	return RestoreSnapshot( *mLevelStartSnapshot );
+}
+
+void
+LevelController::SaveSnapshot( Snapshot& snapshot ) const
+{
+	mPhysics->SaveSnapshot( snapshot.physics );
+	snapshot.portals.resize( mPortalGraph->GetNumPortals() );
+	for( int i = 0; i < mPortalGraph->GetNumPortals(); i++ )
+	{
+		snapshot.portals[i] = mPortalGraph->GetPortal( i )->GetPlacement();
+	}
+	snapshot.box_pool = mBoxPool->GetState();
+	if( mStressBoxes )
+	{
+		snapshot.stress_boxes = mStressBoxes->GetState();
+	}
+}
+
+bool
+LevelController::RestoreSnapshot( const Snapshot& snapshot )
+{
+	// 快照失效时什么都不动，不能只恢复传送门
+	if( !mPhysics->IsSnapshotValid( snapshot.physics ) )
+	{
+		std::cerr << "WARNING: Level snapshot is stale, objects were destroyed after it was saved." << std::endl;
+		return false;
+	}
+
+	// 传送门先恢复，放下传送门时会修改墙的碰撞过滤，被传送门影响的物体也要在恢复物理之前放开
+	const int num_portals = std::min( mPortalGraph->GetNumPortals(), static_cast<int>( snapshot.portals.size() ) );
+	for( int i = 0; i < num_portals; i++ )
+	{
+		mPortalGraph->GetPortal( i )->RestorePlacement( snapshot.portals[i] );
+	}
+	mPhysics->RestoreSnapshot( snapshot.physics );
+	mBoxPool->RestoreState( snapshot.box_pool );
+	if( mStressBoxes )
+	{
+		mStressBoxes->RestoreState( snapshot.stress_boxes );
+	}
+	return true;
 }
 
 void 
@@ -265,8 +590,15 @@ LevelController::HandleKeys( std::unordered_map<unsigned int, bool>& key_map )
 		{
 			auto pos = mPlayer->GetPosition();
 			auto dir = glm::normalize( mPlayer->GetLookDirection() );
-			mDyBox->SetPosition( pos + dir * 8.f );
-			mDyBox->Launch( std::move( dir ) * 5000.f );
+			mBoxPool->Spawn( pos + dir * 8.f ).Launch( std::move( dir ) * 5000.f );
+		}
+	}
+	if( key_map['r'] != mRestartToggle )
+	{
+		mRestartToggle = key_map['r'];
+		if( mRestartToggle )
+		{
+			RestartLevel();
 		}
 	}
 }
@@ -288,37 +620,137 @@ LevelController::HandleMouseMove( int x, int y )
 void 
 LevelController::HandleMouseButton( std::unordered_map<int, bool>& button_map )
 {
-	mPlayer->HandleMouse( button_map, *mPortals[ PORTAL_1 ], *mPortals[ PORTAL_2 ] );
+	mPlayer->HandleMouse( button_map, *mPortalGraph->GetPortal( PORTAL_1 ), *mPortalGraph->GetPortal( PORTAL_2 ) );
 }
 
 void
 LevelController::RenderScene()
 {
-	if( mPortals[ PORTAL_1 ]->IsLinkActive() )
+	if( !mRenderer )
+	{
+		return;
+	}
+	PORTAL_PROFILE_SCOPE( "LevelController::RenderScene" );
+	GpuProfiler::Scope gpu_scope( mRenderer->GetGpuProfiler(), "RenderScene" );
+	const glm::mat4 view_matrix = InterpolateRenderTransforms();
+	if( !mPortalGraph->GetLinkedPortals().empty() )
 	{
-		RenderPortals( mMainCamera.get()->GetViewMatrix(), mMainCamProjMat );
+		BuildPortalViews( view_matrix, mMainCamProjMat );
+		RenderPortals();
 	}
 	else
 	{
-		RenderBaseScene( mMainCamera.get()->GetViewMatrix(), mMainCamProjMat );
+		RenderBaseScene( view_matrix, mMainCamProjMat );
 		RenderDebugInfo();
 	}
 }
 
+glm::mat4
+LevelController::InterpolateRenderTransforms()
+{
+	const float alpha = mPhysics->GetInterpolationAlpha();
+	mBoxPool->Interpolate( alpha );
+	if( mStressBoxes )
+	{
+		mStressBoxes->Interpolate( alpha );
+	}
+
+	glm::mat4 view_matrix = mMainCamera->GetViewMatrix();
+	if( mPlayer && !mIsCameraScripted )
+	{
+		// 摄像机跟着玩家的胶囊，视点平移到插值后的位置，视线方向不变
+		const glm::vec3 eye_offset = mPlayer->GetInterpolatedCameraPosition( alpha ) - mMainCamera->GetPosition();
+		view_matrix = view_matrix * glm::translate( glm::mat4( 1.f ), -eye_offset );
+	}
+	return view_matrix;
+}
+
+TextureInfo*
+LevelController::GetTexture( const std::string& path ) const
+{
+	return mRenderer ? mRenderer->GetResources().GetTextureInfo( path ) : nullptr;
+}
+
 void
 LevelController::RenderDebugInfo()
 {
 	if( mPhysics )
 	{
+		PORTAL_PROFILE_SCOPE( "LevelController::RenderDebugInfo" );
+		GpuProfiler::Scope gpu_scope( mRenderer->GetGpuProfiler(), "DebugDraw" );
 		mPhysics->DebugRender();
 	}
 }
 
+void
+LevelController::BuildPortalViews( glm::mat4 view_matrix, glm::mat4 projection_matrix )
+{
+	PORTAL_PROFILE_SCOPE( "LevelController::BuildPortalViews" );
+	const std::vector<Portal*>& linked_portals = mPortalGraph->GetLinkedPortals();
+	mPortalViews.clear();
+	mPortalViews.push_back( { std::move( view_matrix ), std::move( projection_matrix ), nullptr, 0, 0 } );
+
+	// 按层展开，节点数到了上限时先保证浅的层
+	// 第MAX_PORTAL_RECURSION + 1层的节点只画场景，不再往下
+	int level_begin = 0;
+	for( int level = 0; level <= MAX_PORTAL_RECURSION; level++ )
+	{
+		const int level_end = static_cast<int>( mPortalViews.size() );
+		for( int node = level_begin; node < level_end; node++ )
+		{
+			const glm::mat4 node_view = mPortalViews[ node ].view;
+			const glm::mat4 view_projection = mPortalViews[ node ].projection * node_view;
+			const glm::vec3 node_cam_pos = utility::extract_view_postion_from_matrix( node_view );
+			mPortalViews[ node ].first_child = static_cast<int>( mPortalViews.size() );
+			for( Portal* portal : linked_portals )
+			{
+				if( static_cast<int>( mPortalViews.size() ) >= MAX_PORTAL_VIEWS )
+				{
+					break;
+				}
+				// 从背面看不到门里的内容，视野外的传送门也不用展开
+				if( glm::dot( node_cam_pos - portal->GetPosition(), portal->GetFaceDir() ) <= 0.f ||
+					!utility::is_sphere_in_frustum( view_projection, portal->GetPosition(), portal->GetHoleRadius() ) )
+				{
+					continue;
+				}
+				// 将当前的摄像机视图矩阵变换到配对的传送门后相对的位置
+				const glm::mat4 portal_view = portal->ConvertView( node_view );
+				// 因为新的虚拟摄像机在传送门后，为了不被传送门后的墙挡住视线，我们将投影矩阵的近裁切面设置在传送门的位置
+				const glm::vec3 cam_pos = utility::extract_view_postion_from_matrix( portal_view );
+				const float distance_to_portal = glm::length( cam_pos - portal->GetPairedPortal()->GetPosition() );
+				mPortalViews.push_back( {
+					portal_view,
+					glm::perspective(
+						glm::radians( 90.f ),
+						16.f / 9.f,
+						distance_to_portal - 1.1f,
+						1000.f
+					),
+					portal,
+					0,
+					0
+				} );
+			}
+			mPortalViews[ node ].num_children = static_cast<int>( mPortalViews.size() ) - mPortalViews[ node ].first_child;
+		}
+		level_begin = level_end;
+	}
+}
+
 void 
-LevelController::RenderPortals( glm::mat4 view_matrix, glm::mat4 projection_matrix, int current_recursion_level )
+LevelController::RenderPortals( int node, int current_recursion_level )
 {
-	for( auto& portal : mPortals )
+	PORTAL_PROFILE_SCOPE_ARG( "LevelController::RenderPortals", current_recursion_level );
+	GpuProfiler& gpu_profiler = mRenderer->GetGpuProfiler();
+	const glm::mat4 view_matrix = mPortalViews[ node ].view;
+	const glm::mat4 projection_matrix = mPortalViews[ node ].projection;
+	const int first_child = mPortalViews[ node ].first_child;
+	const int end_child = first_child + mPortalViews[ node ].num_children;
+	for( int portal_node = first_child; portal_node < end_child; portal_node++ )
 	{
+		Portal* portal = mPortalViews[ portal_node ].portal;
+		gpu_profiler.BeginScope( "PortalStencil", current_recursion_level );
 		// 关闭颜色和深度缓存写入
 		glColorMask( GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE );
 		glDepthMask( GL_FALSE );
@@ -339,25 +771,18 @@ LevelController::RenderPortals( glm::mat4 view_matrix, glm::mat4 projection_matr
 		// 屏幕上传送门窗口覆盖的位置会因为规则 glStencilFunc( GL_NOTEQUAL, current_recursion_level, 0xFF )
 		// 不通过测试，因此它所覆盖的像素模板值会根据 glStencilOp( GL_INCR, GL_KEEP, GL_KEEP ) 进行current_recursion_level+1
 		// 结果是模板缓存中除了传送门窗口的像素是1，其他都是0
-		mRenderer.SetViewMatrix( view_matrix );
-		mRenderer.SetProjectionMatrix( projection_matrix );
-		mRenderer.RenderOneoff( portal->GetHoleRenderable() );
-
-		// 将当前的摄像机视图矩阵变换到配对的传送门后相对的位置
-		glm::mat4 portal_view = portal->ConvertView( view_matrix );
-		// 因为新的虚拟摄像机在传送门后，为了不被传送门后的墙挡住视线，我们将投影矩阵的近裁切面设置在传送门的位置
-		glm::vec3 cam_pos = utility::extract_view_postion_from_matrix( portal_view );
-		float distance_to_portal =  glm::length( cam_pos - portal->GetPairedPortal()->GetPosition() );
-		glm::mat4 portal_cam_proj_mat = 
-			glm::perspective( 
-				glm::radians( 90.f ),
-				16.f / 9.f,
-				distance_to_portal - 1.1f,
-				1000.f
-			);
+		mRenderer->SetViewMatrix( view_matrix );
+		mRenderer->SetProjectionMatrix( projection_matrix );
+		mRenderer->RenderOneoff( portal->GetHoleRenderable() );
+		gpu_profiler.EndScope();
+
+		// 配对传送门后的摄像机，见BuildPortalViews()
+		const glm::mat4& portal_view = mPortalViews[ portal_node ].view;
+		const glm::mat4& portal_cam_proj_mat = mPortalViews[ portal_node ].projection;
 
+		gpu_profiler.BeginScope( "PortalRecursion", current_recursion_level + 1 );
 		// 这是最底层了，渲染最底层的传送门内容
-		if( current_recursion_level == MAX_PORTAL_RECURSION )
+		if( current_recursion_level == MAX_PORTAL_RECURSION || mPortalViews[ portal_node ].num_children == 0 )
 		{
 			// 允许颜色和深度写入
 			glColorMask( GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE );
@@ -381,9 +806,11 @@ LevelController::RenderPortals( glm::mat4 view_matrix, glm::mat4 projection_matr
 		{
 			// 如果这还不是最底层，我们进行递归
 			// 把这个传送门配对传送门的摄像机传到递归函数中进行绘制，并且将递归层数+1确保递归会结束
-			RenderPortals( portal_view, portal_cam_proj_mat, current_recursion_level + 1 );
+			RenderPortals( portal_node, current_recursion_level + 1 );
 		}
+		gpu_profiler.EndScope();
 
+		gpu_profiler.BeginScope( "PortalStencilRestore", current_recursion_level );
 		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
 		glDepthMask(GL_FALSE);
 
@@ -396,12 +823,13 @@ LevelController::RenderPortals( glm::mat4 view_matrix, glm::mat4 projection_matr
 		// 不通过测试的像素模板值会-1，直到退回到递归最高层时我们最终的模板缓存会全部变为0
 		glStencilOp( GL_DECR, GL_KEEP, GL_KEEP );
 
-		mRenderer.SetProjectionMatrix( portal_cam_proj_mat );
-		mRenderer.SetViewMatrix( view_matrix );
-		for( auto& portal : mPortals )
+		mRenderer->SetProjectionMatrix( portal_cam_proj_mat );
+		mRenderer->SetViewMatrix( view_matrix );
+		for( int i = first_child; i < end_child; i++ )
 		{
-			mRenderer.RenderOneoff( portal->GetHoleRenderable() );
+			mRenderer->RenderOneoff( mPortalViews[i].portal->GetHoleRenderable() );
 		}
+		gpu_profiler.EndScope();
 	}
 	
 	// 关闭模板测试和颜色写入
@@ -417,13 +845,15 @@ LevelController::RenderPortals( glm::mat4 view_matrix, glm::mat4 projection_matr
 	glDepthFunc( GL_ALWAYS );
 	glClear( GL_DEPTH_BUFFER_BIT );
 
-	// 将两个传送门的窗口写入到深度缓存
-	mRenderer.SetProjectionMatrix( projection_matrix );
-	mRenderer.SetViewMatrix( view_matrix );
-	for( auto& portal : mPortals )
+	// 将看得到的传送门的窗口写入到深度缓存
+	gpu_profiler.BeginScope( "PortalDepth", current_recursion_level );
+	mRenderer->SetProjectionMatrix( projection_matrix );
+	mRenderer->SetViewMatrix( view_matrix );
+	for( int i = first_child; i < end_child; i++ )
 	{
-		mRenderer.RenderOneoff( portal->GetHoleRenderable() );
+		mRenderer->RenderOneoff( mPortalViews[i].portal->GetHoleRenderable() );
 	}
+	gpu_profiler.EndScope();
 	// 将深度测试设回默认（近的挡住远的）
 	glDepthFunc( GL_LESS );
 
@@ -447,36 +877,36 @@ LevelController::RenderPortals( glm::mat4 view_matrix, glm::mat4 projection_matr
 void 
 LevelController::RenderBaseScene( glm::mat4 view_matrix, glm::mat4 projection_matrix )
 {
+	PORTAL_PROFILE_SCOPE( "LevelController::RenderBaseScene" );
 	RenderSkybox( view_matrix, projection_matrix );
-	mRenderer.SetProjectionMatrix( std::move( projection_matrix ) );
-	mRenderer.SetViewMatrix( std::move( view_matrix ) );
+	GpuProfiler::Scope gpu_scope( mRenderer->GetGpuProfiler(), "BaseScene" );
+	mRenderer->SetProjectionMatrix( std::move( projection_matrix ) );
+	mRenderer->SetViewMatrix( std::move( view_matrix ) );
 	// 绘制除了“真传送门”以外的场景
 	auto& walls = mCurrentLevel->GetWalls();
 	for( auto& wall : walls )
 	{
-		mRenderer.RenderOneoff( wall.render_instance.get() );
+		mRenderer->RenderOneoff( wall.render_instance.get() );
 	}
 	// 绘制传送门的框
-	for( auto& portal : mPortals )
+	for( Portal* portal : mPortalGraph->GetPlacedPortals() )
 	{
-		if( portal->HasBeenPlaced() )
-		{
-			mRenderer.RenderOneoff( portal->GetFrameRenderable() );
-		}
+		mRenderer->RenderOneoff( portal->GetFrameRenderable() );
 	}
-	mRenderer.RenderOneoff( mDyBox.get() );
-	if( mRenderClone )
+	mBoxPool->Render( *mRenderer );
+	if( mStressBoxes )
 	{
-		mRenderer.RenderOneoff( mDyBox->GetClone() );
+		mStressBoxes->Render( *mRenderer );
 	}
 }
 
 void
 LevelController::RenderSkybox( glm::mat4 view_matrix, glm::mat4 projection_matrix )
 {
-	mRenderer.SetProjectionMatrix( std::move( projection_matrix ) );
-	mRenderer.SetViewMatrix( std::move( view_matrix ) );
+	GpuProfiler::Scope gpu_scope( mRenderer->GetGpuProfiler(), "Skybox" );
+	mRenderer->SetProjectionMatrix( std::move( projection_matrix ) );
+	mRenderer->SetViewMatrix( std::move( view_matrix ) );
 	glFrontFace( GL_CCW );
-	mRenderer.RenderOneoff( mSkybox.get() );
+	mRenderer->RenderOneoff( mSkybox.get() );
 	glFrontFace( GL_CW );
 }
@@ -16,8 +16,16 @@ namespace portal
 	class Renderer;
 	class Camera;
 	class Portal;
-	class DynamicBox;
+	class PortalGraph;
+	class PortalSpatialHash;
+	class DynamicBoxPool;
 	class Player;
+	struct TextureInfo;
+
+	namespace physics
+	{
+		class DebugRenderer;
+	}
 
 	///
 	/// 简单关卡控制器
@@ -46,6 +54,16 @@ namespace portal
 				std::unique_ptr<physics::Physics::Box> mCollisionBox;
 			};
 
+			///
+			/// 关卡里预先放好的一对传送门
+			/// 每个传送门从from向to发射射线，放在击中的墙面上（和基准测试脚本一样）
+			/// 
+			struct PortalPair
+			{
+				glm::vec3 from[2];
+				glm::vec3 to[2];
+			};
+
 			Level();
 			~Level() = default;
 
@@ -65,21 +83,117 @@ namespace portal
 			void SetSpawn( glm::vec3 point );
 			glm::vec3 GetSpawn() const;
 
+			///
+			/// 加一对传送门，读取关卡文件时使用
+			/// 
+			void AddPortalPair( PortalPair pair );
+			const std::vector<PortalPair>& GetPortalPairs() const;
+
 		private:
 			std::vector<Wall> mWalls;
+			std::vector<PortalPair> mPortalPairs;
 			bool mIsBuilt;
 			glm::vec3 mSpawnPoint;
 		};
 
-		LevelController( Renderer& renderer );
+		///
+		/// 构造函数
+		/// 
+		/// @param renderer
+		///		nullptr表示无头模式：玩家、传送门、盒子和传送照常模拟，但不需要OpenGL context，
+		///		不创建只用于渲染的物体，RenderScene()什么都不做
+		/// 
+		explicit LevelController( Renderer* renderer );
 		~LevelController();
 
-		void Initialize( int update_interval_ms );
+		///
+		/// 初始化物理
+		/// 
+		/// @param update_interval_ms
+		///		游戏逻辑更新间隔，也是物理的固定步长
+		/// 
+		/// @param physics_settings
+		///		物理世界的配置（线程数等）
+		/// 
+		void Initialize( int update_interval_ms, const physics::Settings& physics_settings = physics::Settings{} );
 
 		bool LoadLevelFile( const std::string& path );
-		void ChangeLevelTo( const std::string& path );
+
+		///
+		/// 切换关卡
+		/// 
+		/// @param path
+		///		已经用LoadLevelFile()读取的关卡文件
+		/// 
+		/// @param bake_static_walls
+		///		把所有墙合并成一个静态碰撞体（见Physics::StaticCompound），墙很多的关卡用
+		///		否则每面墙都是一个独立的刚体
+		/// 
+		void ChangeLevelTo( const std::string& path, bool bake_static_walls = false );
 
 		void Update();
+
+		///
+		/// 开启后物理每次Update()固定推进一个更新间隔，不再读取系统时钟
+		/// 
+		void SetDeterministic( bool deterministic );
+
+		///
+		/// 从from向to发射射线，在击中的表面放置传送门
+		/// 
+		/// @param index
+		///		传送门在PortalGraph里的序号：0是玩家的蓝色传送门，1是橙色传送门，之后是关卡里的传送门对
+		/// 
+		/// @return
+		///		True表示放置成功
+		/// 
+		bool PlacePortal( int index, glm::vec3 from, glm::vec3 to );
+
+		///
+		/// 移除传送门
+		/// 
+		/// @param index
+		///		同PlacePortal()
+		/// 
+		void RemovePortal( int index );
+
+		///
+		/// 当前关卡的传送门数量（包括没放置的），关卡还没加载时是0
+		/// 
+		int GetNumPortals() const;
+
+		///
+		/// 直接设置主摄像机的位置和焦点，覆盖玩家的摄像机
+		/// 需要在Update()之后调用
+		/// 
+		void SetCameraPose( glm::vec3 position, glm::vec3 target );
+
+		physics::Physics& GetPhysics();
+
+		///
+		/// 物理压力测试：在关卡上空生成一堆盒子并随机发射出去
+		/// 同样的数量每次生成的位置和力都一样
+		/// 
+		/// @param count
+		///		盒子数量
+		/// 
+		void SpawnStressBoxes( int count );
+
+		///
+		/// 按E发射的盒子最多同时存在多少个，超出时回收最早发射的
+		/// 需要在ChangeLevelTo()之前调用
+		/// 
+		void SetBoxPoolCapacity( int capacity );
+
+		///
+		/// 把关卡恢复到刚进入时的样子（玩家、盒子和传送门），不重新加载关卡
+		/// 快照在ChangeLevelTo()和SpawnStressBoxes()结束时保存，按R也会调用
+		/// 
+		/// @return
+		///		还没有进入关卡或者快照已经失效时返回false
+		/// 
+		bool RestartLevel();
+
 		void HandleKeys( std::unordered_map<unsigned int, bool>& key_map );
 		void HandleMouseMove( int x, int y );
 		void HandleMouseButton( std::unordered_map<int, bool>& button_map );
@@ -87,13 +201,49 @@ namespace portal
 		void RenderScene();
 
 	private:
+		struct Snapshot;
+
+		void SaveSnapshot( Snapshot& snapshot ) const;
+		bool RestoreSnapshot( const Snapshot& snapshot );
+
+		///
+		/// 获取已加载的贴图，无头模式下总是nullptr
+		/// 
+		TextureInfo* GetTexture( const std::string& path ) const;
+
 		void RenderDebugInfo();
 
-		void RenderPortals( glm::mat4 view_matrix, glm::mat4 projection_matrix, int current_recursion_level = 0 );
+		///
+		/// 按物理插值更新渲染位置，返回主摄像机的视图矩阵
+		/// 
+		glm::mat4 InterpolateRenderTransforms();
+
+		///
+		/// 传送门递归渲染中的一个节点
+		/// 0是主摄像机，其他节点是穿过父节点能看到的某个传送门后的虚拟摄像机
+		/// 同一个节点的子节点是连续存放的
+		/// 
+		struct PortalView
+		{
+			glm::mat4 view;
+			glm::mat4 projection;
+			Portal* portal;  ///< 穿过的传送门，主摄像机是nullptr
+			int first_child;
+			int num_children;
+		};
+
+		///
+		/// 渲染前一次算好递归中所有节点的视图和投影矩阵
+		/// 每个节点只往下展开在它视野内、而且正面朝向它的传送门，节点总数不超过MAX_PORTAL_VIEWS
+		/// 
+		void BuildPortalViews( glm::mat4 view_matrix, glm::mat4 projection_matrix );
+
+		void RenderPortals( int node = 0, int current_recursion_level = 0 );
 		void RenderBaseScene( glm::mat4 view_matrix, glm::mat4 projection_matrix );
 		void RenderSkybox( glm::mat4 view_matrix, glm::mat4 projection_matrix );
 
-		Renderer& mRenderer;
+		Renderer* mRenderer; ///< 无头模式下为nullptr
+		std::unique_ptr<physics::DebugRenderer> mPhysicsDebugRenderer;
 		std::unique_ptr<physics::Physics> mPhysics;
 		std::unordered_map<std::string, std::unique_ptr<Level>> mLevels;
 		std::unique_ptr<Player> mPlayer;
@@ -101,13 +251,23 @@ namespace portal
 		int mMouseX;
 		int mMouseY;
 		std::unique_ptr<SceneSkyBox> mSkybox;
-		std::unique_ptr<Portal> mPortals[2];
+		std::unique_ptr<PortalGraph> mPortalGraph; ///< 第0对是玩家用鼠标放置的，之后是关卡里的
+		std::unique_ptr<PortalSpatialHash> mPortalSpatialHash; ///< 登记了玩家和按E发射的盒子
+		uint64_t mPortalHashVersion; ///< mPortalSpatialHash重建时PortalGraph::GetPlacementVersion()的值
+		std::unique_ptr<physics::Physics::StaticCompound> mStaticWalls; ///< 合并后的墙，没有合并时为nullptr
 		Level* mCurrentLevel;
 		glm::mat4 mMainCamProjMat;
+		std::vector<PortalView> mPortalViews; ///< 见BuildPortalViews()，只是为了复用内存
 
-		std::unique_ptr<DynamicBox> mDyBox;
-		bool mShootBoxToggle = false;
-		bool mRenderClone = false;
+		std::unique_ptr<DynamicBoxPool> mBoxPool;
+		std::unique_ptr<DynamicBoxPool> mStressBoxes; ///< 不参与传送门逻辑
+		int mBoxPoolCapacity;
+		bool mShootBoxToggle;
+		bool mRestartToggle;
+		std::unique_ptr<Snapshot> mLevelStartSnapshot;
+		float mUpdateInterval; ///< 游戏逻辑更新间隔 单位：秒
+		bool mIsDeterministic;
+		bool mIsCameraScripted; ///< 摄像机由SetCameraPose()控制，不再跟随玩家
 	};
 }
 
@@ -0,0 +1,133 @@
+#ifndef _OBJECT_POOL_H
+#define _OBJECT_POOL_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace portal
+{
+	///
+	/// 固定大小对象的内存池
+	/// 按块申请内存，释放的对象放回空闲链表给下一次Create()用，块本身直到内存池销毁时才释放。
+	/// 同一类型的物体频繁创建销毁时不再走通用的堆分配。
+	///
+	/// 不是线程安全的；所有对象必须在内存池销毁前还回来
+	///
+	template<typename T>
+	class ObjectPool
+	{
+	public:
+		///
+		/// 把对象还给内存池的deleter，配合std::unique_ptr/std::shared_ptr使用
+		///
+		struct Deleter
+		{
+			ObjectPool* pool = nullptr;
+
+			void operator()( T* object ) const
+			{
+				pool->Destroy( object );
+			}
+		};
+		using Ptr = std::unique_ptr<T, Deleter>;
+
+		///
+		/// 构造函数
+		///
+		/// @param objects_per_block
+		///		每次向系统申请的对象个数
+		///
+		explicit ObjectPool( size_t objects_per_block = 64 )
+			: mObjectsPerBlock( objects_per_block > 0 ? objects_per_block : 1 )
+			, mFreeList( nullptr )
+			, mNumAlive( 0 )
+		{}
+		~ObjectPool() = default;
+
+		ObjectPool( const ObjectPool& ) = delete;
+		ObjectPool& operator=( const ObjectPool& ) = delete;
+
+		///
+		/// 在池里构造一个对象
+		///
+		template<typename... Args>
+		T* Create( Args&&... args )
+		{
+			if( !mFreeList )
+			{
+				AllocateBlock();
+			}
+			Slot* slot = mFreeList;
+			mFreeList = slot->next;
+			mNumAlive++;
+			return new( slot->storage ) T( std::forward<Args>( args )... );
+		}
+
+		template<typename... Args>
+		Ptr MakeUnique( Args&&... args )
+		{
+			return Ptr( Create( std::forward<Args>( args )... ), Deleter{ this } );
+		}
+
+		///
+		/// 析构对象并把内存放回池里
+		///
+		void Destroy( T* object )
+		{
+			if( !object )
+			{
+				return;
+			}
+			object->~T();
+			Slot* slot = reinterpret_cast<Slot*>( object );
+			slot->next = mFreeList;
+			mFreeList = slot;
+			mNumAlive--;
+		}
+
+		///
+		/// 还没还回来的对象数量
+		///
+		size_t GetNumAlive() const
+		{
+			return mNumAlive;
+		}
+
+		///
+		/// 已经申请的对象个数（包括空闲的）
+		///
+		size_t GetCapacity() const
+		{
+			return mBlocks.size() * mObjectsPerBlock;
+		}
+
+	private:
+		union Slot
+		{
+			Slot* next;
+			alignas( T ) unsigned char storage[ sizeof( T ) ];
+		};
+
+		void AllocateBlock()
+		{
+			mBlocks.emplace_back( new Slot[ mObjectsPerBlock ] );
+			Slot* block = mBlocks.back().get();
+			// 倒着串起来，这样先用块开头的对象
+			for( size_t i = mObjectsPerBlock; i > 0; i-- )
+			{
+				block[ i - 1 ].next = mFreeList;
+				mFreeList = &block[ i - 1 ];
+			}
+		}
+
+		size_t mObjectsPerBlock;
+		std::vector<std::unique_ptr<Slot[]>> mBlocks;
+		Slot* mFreeList;
+		size_t mNumAlive;
+	};
+}
+
+#endif
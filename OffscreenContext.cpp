@@ -0,0 +1,175 @@
+#include "OffscreenContext.h"
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <GL/glew.h>
+
+#ifdef PORTAL_HAS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+using namespace portal;
+
+OffscreenContext::OffscreenContext( int width, int height )
+	: mWidth( width )
+	, mHeight( height )
+	, mDisplay( nullptr )
+	, mContext( nullptr )
+	, mFramebuffer( 0 )
+	, mColorBuffer( 0 )
+	, mDepthStencilBuffer( 0 )
+{
+}
+
+OffscreenContext::~OffscreenContext()
+{
+	if( mFramebuffer )
+	{
+		glDeleteFramebuffers( 1, &mFramebuffer );
+		glDeleteRenderbuffers( 1, &mColorBuffer );
+		glDeleteRenderbuffers( 1, &mDepthStencilBuffer );
+	}
+#ifdef PORTAL_HAS_EGL
+	if( mDisplay )
+	{
+		eglMakeCurrent( mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+		if( mContext )
+		{
+			eglDestroyContext( mDisplay, mContext );
+		}
+		eglTerminate( mDisplay );
+	}
+#endif
+}
+
+bool
+OffscreenContext::Initialize()
+{
+#ifdef PORTAL_HAS_EGL
+	// 优先使用Mesa的surfaceless平台，完全不需要显示服务器
+	EGLDisplay display = EGL_NO_DISPLAY;
+	auto get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>( eglGetProcAddress( "eglGetPlatformDisplayEXT" ) );
+	if( get_platform_display )
+	{
+		display = get_platform_display( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr );
+	}
+	if( display == EGL_NO_DISPLAY )
+	{
+		display = eglGetDisplay( EGL_DEFAULT_DISPLAY );
+	}
+
+	EGLint major = 0;
+	EGLint minor = 0;
+	if( display == EGL_NO_DISPLAY || !eglInitialize( display, &major, &minor ) )
+	{
+		std::cerr << "ERROR: Failed to initialize EGL display, error: 0x" << std::hex << eglGetError() << std::dec << std::endl;
+		return false;
+	}
+	mDisplay = display;
+
+	if( !eglBindAPI( EGL_OPENGL_API ) )
+	{
+		std::cerr << "ERROR: EGL does not support desktop OpenGL." << std::endl;
+		return false;
+	}
+
+	const EGLint config_attribs[] = {
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config = nullptr;
+	EGLint num_configs = 0;
+	eglChooseConfig( display, config_attribs, &config, 1, &num_configs );
+
+	// 和窗口模式一样，至少是OpenGL 3.3 Core
+	const EGLint context_attribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	EGLContext context = eglCreateContext( display, num_configs > 0 ? config : EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, context_attribs );
+	if( context == EGL_NO_CONTEXT )
+	{
+		std::cerr << "ERROR: Failed to create EGL context, error: 0x" << std::hex << eglGetError() << std::dec << std::endl;
+		return false;
+	}
+	mContext = context;
+
+	// 没有surface，所有渲染都进FBO
+	if( !eglMakeCurrent( display, EGL_NO_SURFACE, EGL_NO_SURFACE, context ) )
+	{
+		std::cerr << "ERROR: Failed to make EGL context current, error: 0x" << std::hex << eglGetError() << std::dec << std::endl;
+		return false;
+	}
+	return true;
+#else
+	std::cerr << "ERROR: Offscreen rendering is not available, the program is built without EGL." << std::endl;
+	return false;
+#endif
+}
+
+bool
+OffscreenContext::CreateFramebuffer()
+{
+	glGenFramebuffers( 1, &mFramebuffer );
+	glBindFramebuffer( GL_FRAMEBUFFER, mFramebuffer );
+
+	glGenRenderbuffers( 1, &mColorBuffer );
+	glBindRenderbuffer( GL_RENDERBUFFER, mColorBuffer );
+	glRenderbufferStorage( GL_RENDERBUFFER, GL_RGBA8, mWidth, mHeight );
+	glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, mColorBuffer );
+
+	// 传送门渲染需要模板缓存
+	glGenRenderbuffers( 1, &mDepthStencilBuffer );
+	glBindRenderbuffer( GL_RENDERBUFFER, mDepthStencilBuffer );
+	glRenderbufferStorage( GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, mWidth, mHeight );
+	glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, mDepthStencilBuffer );
+
+	const GLenum status = glCheckFramebufferStatus( GL_FRAMEBUFFER );
+	if( status != GL_FRAMEBUFFER_COMPLETE )
+	{
+		std::cerr << "ERROR: Offscreen framebuffer is incomplete, status: 0x" << std::hex << status << std::dec << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void
+OffscreenContext::Bind()
+{
+	glBindFramebuffer( GL_FRAMEBUFFER, mFramebuffer );
+}
+
+glm::ivec2
+OffscreenContext::GetSize() const
+{
+	return { mWidth, mHeight };
+}
+
+bool
+OffscreenContext::SaveScreenshot( const std::string& path )
+{
+	std::vector<unsigned char> pixels( static_cast<size_t>( mWidth ) * mHeight * 3 );
+	Bind();
+	glPixelStorei( GL_PACK_ALIGNMENT, 1 );
+	glReadPixels( 0, 0, mWidth, mHeight, GL_RGB, GL_UNSIGNED_BYTE, pixels.data() );
+
+	std::ofstream ofs{ path, std::ios::binary };
+	if( !ofs.is_open() )
+	{
+		std::cerr << "ERROR: Failed to open screenshot file " << path << std::endl;
+		return false;
+	}
+	ofs << "P6\n" << mWidth << " " << mHeight << "\n255\n";
+	// OpenGL的原点在左下角，图片从上往下写
+	const size_t row_size = static_cast<size_t>( mWidth ) * 3;
+	for( int y = mHeight - 1; y >= 0; y-- )
+	{
+		ofs.write( reinterpret_cast<const char*>( pixels.data() + y * row_size ), row_size );
+	}
+	return true;
+}
@@ -0,0 +1,73 @@
+#ifndef _OFFSCREEN_CONTEXT_H
+#define _OFFSCREEN_CONTEXT_H
+
+#include <string>
+#include <glm/vec2.hpp>
+
+namespace portal
+{
+	///
+	/// 离屏渲染环境
+	/// 不需要窗口，用EGL（surfaceless平台）创建OpenGL 3.3 Core Context，然后渲染到FBO上。
+	/// 可以在没有GPU的机器上用Mesa软件渲染（llvmpipe）运行，用于自动化的渲染测试和性能测试。
+	///
+	/// 需要编译时定义PORTAL_HAS_EGL（CMake找到EGL时会自动定义），否则Initialize()会失败
+	///
+	class OffscreenContext
+	{
+	public:
+		///
+		/// 构造函数
+		///
+		/// @param width, height
+		///		渲染目标的大小
+		///
+		OffscreenContext( int width, int height );
+		~OffscreenContext();
+
+		OffscreenContext( const OffscreenContext& ) = delete;
+		OffscreenContext& operator=( const OffscreenContext& ) = delete;
+
+		///
+		/// 创建EGL Context并设为当前Context，请在glewInit()之前调用
+		///
+		/// @return
+		///		True表示成功
+		///
+		bool Initialize();
+
+		///
+		/// 创建并绑定FBO（颜色 + 深度模板），请在glewInit()之后调用
+		///
+		/// @return
+		///		True表示成功
+		///
+		bool CreateFramebuffer();
+
+		///
+		/// 绑定FBO作为渲染目标
+		///
+		void Bind();
+
+		glm::ivec2 GetSize() const;
+
+		///
+		/// 把当前FBO的颜色内容保存为PPM图片
+		///
+		/// @param path
+		///		文件路径
+		///
+		bool SaveScreenshot( const std::string& path );
+
+	private:
+		int mWidth;
+		int mHeight;
+		void* mDisplay;           ///< EGLDisplay
+		void* mContext;           ///< EGLContext
+		unsigned int mFramebuffer;
+		unsigned int mColorBuffer;
+		unsigned int mDepthStencilBuffer;
+	};
+}
+
+#endif
@@ -1,17 +1,210 @@
 ﻿#include "Physics.h"
 
 #include <bullet/BulletCollision/NarrowPhaseCollision/btRaycastCallback.h>
+#include <bullet/LinearMath/btQuickprof.h>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <glm/common.hpp>
 
-#include "DebugRenderer.h"
-#include "Renderer.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+
+#include <bullet/BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h>
+#include <bullet/BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolverMt.h>
 
 using namespace portal;
 using namespace portal::physics;
 
 namespace
 {
+	constexpr float MAX_FRAME_TIME = 0.25f;     // 单次推进的时间上限 单位：秒
+	constexpr int MAX_STEPS_PER_UPDATE = 5;     // 一次最多追赶的步数
+
+	// 还没有关卡时的世界边界，SetWorldBounds()会换成关卡的范围
+	const AABB DEFAULT_WORLD_BOUNDS{ glm::vec3{ 1000.f }, glm::vec3{ -1000.f } };
+	constexpr unsigned int AXIS_SWEEP_32_MAX_HANDLES = 65536; // Bullet默认150万个，预先分配的内存太多了
+
+	///
+	/// 把Bullet的并行任务交给我们自己的线程池
+	/// 
+	class PhysicsTaskScheduler : public btITaskScheduler
+	{
+	public:
+		PhysicsTaskScheduler( int num_threads )
+			: btITaskScheduler( "PortalThreadPool" )
+			, mThreadPool( std::make_unique<ThreadPool>( std::min( num_threads, static_cast<int>( BT_MAX_THREAD_COUNT ) ) ) )
+		{}
+
+		virtual int getMaxNumThreads() const override
+		{
+			return BT_MAX_THREAD_COUNT;
+		}
+
+		virtual int getNumThreads() const override
+		{
+			return mThreadPool->GetNumThreads();
+		}
+
+		virtual void setNumThreads( int num_threads ) override
+		{
+			num_threads = std::max( 1, std::min( num_threads, static_cast<int>( BT_MAX_THREAD_COUNT ) ) );
+			if( num_threads != mThreadPool->GetNumThreads() )
+			{
+				mThreadPool = std::make_unique<ThreadPool>( num_threads );
+			}
+		}
+
+		virtual void parallelFor( int begin, int end, int grain_size, const btIParallelForBody& body ) override
+		{
+			PORTAL_PROFILE_SCOPE( "Physics::ParallelFor" );
+			mThreadPool->ParallelFor( begin, end, grain_size, [&body]( int chunk_begin, int chunk_end )
+			{
+				body.forLoop( chunk_begin, chunk_end );
+			} );
+		}
+
+		virtual btScalar parallelSum( int begin, int end, int grain_size, const btIParallelSumBody& body ) override
+		{
+			PORTAL_PROFILE_SCOPE( "Physics::ParallelSum" );
+			std::mutex mutex;
+			btScalar sum = 0;
+			mThreadPool->ParallelFor( begin, end, grain_size, [&]( int chunk_begin, int chunk_end )
+			{
+				const btScalar chunk_sum = body.sumLoop( chunk_begin, chunk_end );
+				std::lock_guard<std::mutex> lock( mutex );
+				sum += chunk_sum;
+			} );
+			return sum;
+		}
+
+	private:
+		std::unique_ptr<ThreadPool> mThreadPool;
+	};
+
+	///
+	/// 和ClosestRayResultCallback一样，另外记录击中的是btCompoundShape里的第几个子形状
+	/// 
+	class ClosestRayChildResultCallback : public btCollisionWorld::ClosestRayResultCallback
+	{
+	public:
+		ClosestRayChildResultCallback( const btVector3& from, const btVector3& to )
+			: btCollisionWorld::ClosestRayResultCallback( from, to )
+			, m_childIndex( -1 )
+		{}
+
+		virtual btScalar addSingleResult( btCollisionWorld::LocalRayResult& ray_result, bool normal_in_world_space ) override
+		{
+			// 只有比当前结果更近时才会被调用
+			m_childIndex = ray_result.m_localShapeInfo ? ray_result.m_localShapeInfo->m_triangleIndex : -1;
+			return btCollisionWorld::ClosestRayResultCallback::addSingleResult( ray_result, normal_in_world_space );
+		}
+
+		int m_childIndex;
+	};
+
+	///
+	/// 唤醒broadphase里和给定AABB重叠的动态物体
+	/// 
+	class ActivateAabbCallback : public btBroadphaseAabbCallback
+	{
+	public:
+		virtual
+		bool
+		process( const btBroadphaseProxy* proxy ) override
+		{
+			auto object = static_cast<btCollisionObject*>( proxy->m_clientObject );
+			if( object && !object->isStaticOrKinematicObject() )
+			{
+				object->activate( true );
+			}
+			return true;
+		}
+	};
+
+	///
+	/// 给broadphase计时的包装
+	/// 世界每一步先对每个活动物体调用setAabb()，再调用一次calculateOverlappingPairs()，
+	/// 两者的耗时累加到elapsed_ms。其它调用原样转发
+	/// 
+	class TimedBroadphase : public btBroadphaseInterface
+	{
+	public:
+		TimedBroadphase( std::unique_ptr<btBroadphaseInterface> broadphase, float& elapsed_ms )
+			: mBroadphase( std::move( broadphase ) )
+			, mElapsedMs( elapsed_ms )
+		{}
+
+		virtual btBroadphaseProxy* createProxy( const btVector3& aabb_min, const btVector3& aabb_max, int shape_type, void* user_ptr, int group, int mask, btDispatcher* dispatcher ) override
+		{
+			return mBroadphase->createProxy( aabb_min, aabb_max, shape_type, user_ptr, group, mask, dispatcher );
+		}
+
+		virtual void destroyProxy( btBroadphaseProxy* proxy, btDispatcher* dispatcher ) override
+		{
+			mBroadphase->destroyProxy( proxy, dispatcher );
+		}
+
+		virtual void setAabb( btBroadphaseProxy* proxy, const btVector3& aabb_min, const btVector3& aabb_max, btDispatcher* dispatcher ) override
+		{
+			auto begin = std::chrono::steady_clock::now();
+			mBroadphase->setAabb( proxy, aabb_min, aabb_max, dispatcher );
+			mElapsedMs += std::chrono::duration<float, std::milli>( std::chrono::steady_clock::now() - begin ).count();
+		}
+
+		virtual void getAabb( btBroadphaseProxy* proxy, btVector3& aabb_min, btVector3& aabb_max ) const override
+		{
+			mBroadphase->getAabb( proxy, aabb_min, aabb_max );
+		}
+
+		virtual void rayTest( const btVector3& from, const btVector3& to, btBroadphaseRayCallback& callback, const btVector3& aabb_min, const btVector3& aabb_max ) override
+		{
+			mBroadphase->rayTest( from, to, callback, aabb_min, aabb_max );
+		}
+
+		virtual void aabbTest( const btVector3& aabb_min, const btVector3& aabb_max, btBroadphaseAabbCallback& callback ) override
+		{
+			mBroadphase->aabbTest( aabb_min, aabb_max, callback );
+		}
+
+		virtual void calculateOverlappingPairs( btDispatcher* dispatcher ) override
+		{
+			auto begin = std::chrono::steady_clock::now();
+			mBroadphase->calculateOverlappingPairs( dispatcher );
+			mElapsedMs += std::chrono::duration<float, std::milli>( std::chrono::steady_clock::now() - begin ).count();
+		}
+
+		virtual btOverlappingPairCache* getOverlappingPairCache() override
+		{
+			return mBroadphase->getOverlappingPairCache();
+		}
+
+		virtual const btOverlappingPairCache* getOverlappingPairCache() const override
+		{
+			return mBroadphase->getOverlappingPairCache();
+		}
+
+		virtual void getBroadphaseAabb( btVector3& aabb_min, btVector3& aabb_max ) const override
+		{
+			mBroadphase->getBroadphaseAabb( aabb_min, aabb_max );
+		}
+
+		virtual void resetPool( btDispatcher* dispatcher ) override
+		{
+			mBroadphase->resetPool( dispatcher );
+		}
+
+		virtual void printStats() override
+		{
+			mBroadphase->printStats();
+		}
+
+	private:
+		std::unique_ptr<btBroadphaseInterface> mBroadphase;
+		float& mElapsedMs;
+	};
+
 	class PhysicsContactResultCallback : public btCollisionWorld::ContactResultCallback
 	{
 	public:
@@ -39,12 +232,196 @@ namespace
 	private:
 		std::function<void()> mCallback;
 	};
+
+	///
+	/// Bullet的BT_PROFILE区间
+	/// 钩子是全局的，由所有开了Settings::profile_bullet的Physics共用；
+	/// 每个线程有自己的区间栈，只有正在Step()的线程会把耗时累加到那个Physics的StepProfile里
+	/// 
+	namespace bullet_profile
+	{
+		constexpr int MAX_ZONE_DEPTH = 32;
+		constexpr float NS_TO_MS = 1e-6f;
+
+		struct Zone
+		{
+			const char* name;
+			int64_t begin;
+		};
+
+		thread_local Zone tZones[ MAX_ZONE_DEPTH ];
+		thread_local int tZoneDepth = 0;
+		thread_local Physics::StepProfile* tStepProfile = nullptr;
+
+		int gNumUsers = 0;
+		btEnterProfileZoneFunc* gPreviousEnter = nullptr;
+		btLeaveProfileZoneFunc* gPreviousLeave = nullptr;
+
+		///
+		/// 区间名字到StepProfile里对应的阶段，其他区间（包括外面一层的stepSimulation）不统计
+		/// 
+		float*
+		find_phase( Physics::StepProfile& profile, const char* name )
+		{
+			static const struct
+			{
+				const char* name;
+				float Physics::StepProfile::*phase;
+			} PHASES[] = {
+				{ "updateAabbs", &Physics::StepProfile::broadphase_ms },
+				{ "calculateOverlappingPairs", &Physics::StepProfile::broadphase_ms },
+				{ "dispatchAllCollisionPairs", &Physics::StepProfile::narrowphase_ms },
+				{ "createPredictiveContacts", &Physics::StepProfile::narrowphase_ms },
+				{ "solveConstraints", &Physics::StepProfile::solver_ms },
+				{ "predictUnconstraintMotion", &Physics::StepProfile::integration_ms },
+				{ "integrateTransforms", &Physics::StepProfile::integration_ms },
+			};
+			for( auto& phase : PHASES )
+			{
+				if( std::strcmp( phase.name, name ) == 0 )
+				{
+					return &( profile.*phase.phase );
+				}
+			}
+			return nullptr;
+		}
+
+		void
+		enter_zone( const char* name )
+		{
+			if( tZoneDepth < MAX_ZONE_DEPTH )
+			{
+				tZones[ tZoneDepth ] = { name, profiler::Now() };
+			}
+			tZoneDepth++;
+			gPreviousEnter( name );
+		}
+
+		void
+		leave_zone()
+		{
+			gPreviousLeave();
+			if( tZoneDepth == 0 )
+			{
+				// 钩子是在区间中间装上的
+				return;
+			}
+			tZoneDepth--;
+			if( tZoneDepth >= MAX_ZONE_DEPTH )
+			{
+				return;
+			}
+			const Zone& zone = tZones[ tZoneDepth ];
+			const int64_t end = profiler::Now();
+			// Bullet的区间名字都是字符串常量，可以直接交给分析器
+			if( profiler::IsEnabled() )
+			{
+				profiler::Record( zone.name, zone.begin, end );
+			}
+			if( tStepProfile )
+			{
+				if( float* phase = find_phase( *tStepProfile, zone.name ) )
+				{
+					*phase += ( end - zone.begin ) * NS_TO_MS;
+				}
+			}
+		}
+
+		void
+		add_user()
+		{
+			if( gNumUsers++ == 0 )
+			{
+				gPreviousEnter = btGetCurrentEnterProfileZoneFunc();
+				gPreviousLeave = btGetCurrentLeaveProfileZoneFunc();
+				btSetCustomEnterProfileZoneFunc( enter_zone );
+				btSetCustomLeaveProfileZoneFunc( leave_zone );
+			}
+		}
+
+		void
+		remove_user()
+		{
+			if( --gNumUsers == 0 )
+			{
+				btSetCustomEnterProfileZoneFunc( gPreviousEnter );
+				btSetCustomLeaveProfileZoneFunc( gPreviousLeave );
+			}
+		}
+
+		///
+		/// Step()期间让当前线程的区间累加到profile里
+		/// 
+		class StepScope
+		{
+		public:
+			StepScope( Physics::StepProfile* profile )
+				: mPrevious( tStepProfile )
+			{
+				tStepProfile = profile;
+			}
+
+			~StepScope()
+			{
+				tStepProfile = mPrevious;
+			}
+
+			StepScope( const StepScope& ) = delete;
+			StepScope& operator=( const StepScope& ) = delete;
+
+		private:
+			Physics::StepProfile* mPrevious;
+		};
+	}
+}
+
+const char*
+portal::physics::GetBroadphaseName( Broadphase broadphase )
+{
+	switch( broadphase )
+	{
+	case Broadphase::AXIS_SWEEP:
+		return "sap";
+	case Broadphase::AXIS_SWEEP_32:
+		return "sap32";
+	case Broadphase::DBVT:
+	default:
+		return "dbvt";
+	}
+}
+
+bool
+portal::physics::ParseBroadphaseName( const char* name, Broadphase& broadphase )
+{
+	for( Broadphase candidate : ALL_BROADPHASES )
+	{
+		if( std::strcmp( name, GetBroadphaseName( candidate ) ) == 0 )
+		{
+			broadphase = candidate;
+			return true;
+		}
+	}
+	return false;
 }
 
 ///
 /// Callback implementation
 /// 
 Callback::Callback( std::function<void(bool)> callback )
+{
+	if( callback )
+	{
+		mCallback = [callback = std::move( callback )]( ContactEvent event, const btCollisionObject* )
+		{
+			if( event != ContactEvent::STAY )
+			{
+				callback( event == ContactEvent::BEGIN );
+			}
+		};
+	}
+}
+
+Callback::Callback( std::function<void(ContactEvent, const btCollisionObject*)> callback )
 	: mCallback( std::move( callback ) )
 {
 }
@@ -52,22 +429,108 @@ Callback::Callback( std::function<void(bool)> callback )
 Callback::~Callback()
 {}
 
+Callback::operator bool() const
+{
+	return static_cast<bool>( mCallback );
+}
+
+void
+Callback::operator()( ContactEvent event, const btCollisionObject* other ) const
+{
+	if( mCallback )
+	{
+		mCallback( event, other );
+	}
+}
+
+///
+/// MotionState implementation
+/// 
+MotionState::MotionState( const btTransform& transform )
+	: mPrevious( transform )
+	, mCurrent( transform )
+{
+}
+
+void
+MotionState::getWorldTransform( btTransform& transform ) const
+{
+	transform = mCurrent;
+}
+
+void
+MotionState::setWorldTransform( const btTransform& transform )
+{
+	mPrevious = mCurrent;
+	mCurrent = transform;
+}
+
+void
+MotionState::Reset( const btTransform& transform )
+{
+	mPrevious = transform;
+	mCurrent = transform;
+}
+
+void
+MotionState::Restore( const btTransform& previous, const btTransform& current )
+{
+	mPrevious = previous;
+	mCurrent = current;
+}
+
+const btTransform&
+MotionState::GetPrevious() const
+{
+	return mPrevious;
+}
+
+btTransform
+MotionState::Interpolate( float alpha ) const
+{
+	btTransform transform;
+	transform.setOrigin( mPrevious.getOrigin().lerp( mCurrent.getOrigin(), alpha ) );
+	transform.setRotation( mPrevious.getRotation().slerp( mCurrent.getRotation(), alpha ) );
+	return transform;
+}
+
 ///
 /// PhysicsObject implementation
 /// 
 Physics::PhysicsObject::PhysicsObject( glm::vec3 pos,
-									   btDiscreteDynamicsWorld& world, 
+									   Physics& physics, 
 									   Type type,
 									   physics::Callback callback )
-	: mWorld( world )
+	: mPhysics( physics )
+	, mWorld( *physics.mWorld )
 	, mType( type )
+	, mGroup( 0 )
+	, mMask( 0 )
+	, mIsSimulated( false )
 	, mCallback( std::move( callback ) )
+	, mContactDispatcher( nullptr )
 {
 }
 
 Physics::PhysicsObject::~PhysicsObject()
 {
+	if( mContactDispatcher )
+	{
+		mContactDispatcher->UnregisterContactListener( *this );
+	}
 	if( mBody )
+	{
+		mPhysics.RemoveContactPairs( *this, false );
+	}
+	auto& moving_objects = mPhysics.mMovingObjects;
+	auto itr = std::find( moving_objects.begin(), moving_objects.end(), this );
+	if( itr != moving_objects.end() )
+	{
+		*itr = moving_objects.back();
+		moving_objects.pop_back();
+		mPhysics.mRemovedObjects++;
+	}
+	if( mBody && mIsSimulated )
 	{
 		mWorld.removeRigidBody( mBody.get() );
 	}
@@ -79,7 +542,7 @@ Physics::PhysicsObject::BuildRigidBody( glm::vec3 pos, btCollisionShape* collisi
 	btTransform box_transform;
 	box_transform.setIdentity();
 	box_transform.setOrigin( btVector3( pos.x, pos.y, pos.z ) );
-	btDefaultMotionState* motion_state = new btDefaultMotionState( box_transform );
+	mMotionState = mPhysics.mMotionStatePool.MakeUnique( box_transform );
 
 	btScalar mass = 80.f;
 	btVector3 local_intertia( 0.f, 0.f, 0.f );
@@ -92,14 +555,25 @@ Physics::PhysicsObject::BuildRigidBody( glm::vec3 pos, btCollisionShape* collisi
 		collision_shape->calculateLocalInertia( mass, local_intertia );
 	}
 
-	btRigidBody::btRigidBodyConstructionInfo rbInfo( mass, motion_state, collision_shape, local_intertia );
+	btRigidBody::btRigidBodyConstructionInfo rbInfo( mass, mMotionState.get(), collision_shape, local_intertia );
 	
-	mBody = std::make_unique<btRigidBody>( rbInfo );
+	mBody = mPhysics.mRigidBodyPool.MakeUnique( rbInfo );
 	if( is_ghost )
 	{
 		mBody->setCollisionFlags( btCollisionObject::CF_NO_CONTACT_RESPONSE );
 	}
+	else if( mType == Type::DYNAMIC )
+	{
+		EnableContinuousCollision( collision_shape );
+	}
+	mGroup = group;
+	mMask = mask;
 	mWorld.addRigidBody( mBody.get(), group, mask );
+	mIsSimulated = true;
+	if( mType != Type::STATIC )
+	{
+		mPhysics.mMovingObjects.push_back( this );
+	}
 }
 
 glm::vec3
@@ -159,9 +633,25 @@ Physics::PhysicsObject::SetPosition( glm::vec3 pos )
 	btTransform transform;
 	transform.setIdentity();
 	transform.setOrigin( btVector3( pos.x, pos.y, pos.z ) );
+	mMotionState->Reset( transform );
 	mBody->setWorldTransform( std::move( transform ) );
 }
 
+void
+Physics::PhysicsObject::EnableContinuousCollision( btCollisionShape* collision_shape )
+{
+	btTransform identity;
+	identity.setIdentity();
+	btVector3 min, max;
+	collision_shape->getAabb( identity, min, max );
+	const btVector3 half_extents = ( max - min ) / 2.f;
+	const btScalar min_half_extent = half_extents[ half_extents.minAxis() ];
+
+	// 扫掠球要比形状的内切球小一点，否则贴着墙滑动时也会被当成碰撞
+	mBody->setCcdMotionThreshold( min_half_extent );
+	mBody->setCcdSweptSphereRadius( min_half_extent * 0.8f );
+}
+
 void 
 Physics::PhysicsObject::SetImpluse( glm::vec3 force, glm::vec3 pos )
 {
@@ -174,11 +664,44 @@ Physics::PhysicsObject::Activate()
 	mBody->activate( true );
 }
 
+bool
+Physics::PhysicsObject::IsActive() const
+{
+	return mBody->isActive();
+}
+
+void
+Physics::PhysicsObject::SetSimulated( bool simulated )
+{
+	if( simulated == mIsSimulated )
+	{
+		return;
+	}
+	if( simulated )
+	{
+		mWorld.addRigidBody( mBody.get(), mGroup, mMask );
+		mBody->activate( true );
+	}
+	else
+	{
+		mWorld.removeRigidBody( mBody.get() );
+		mPhysics.RemoveContactPairs( *this, true );
+	}
+	mIsSimulated = simulated;
+}
+
+bool
+Physics::PhysicsObject::IsSimulated() const
+{
+	return mIsSimulated;
+}
+
 void 
 Physics::PhysicsObject::SetTransform( glm::mat4 transform_mat )
 {
 	btTransform transform;
 	transform.setFromOpenGLMatrix( glm::value_ptr( transform_mat ) );
+	mMotionState->Reset( transform );
 	mBody->setWorldTransform( std::move( transform ) );
 }
 
@@ -191,10 +714,43 @@ Physics::PhysicsObject::GetTransform()
 	return glm::make_mat4x4( mat_val );
 }
 
+glm::mat4
+Physics::PhysicsObject::GetInterpolatedTransform( float alpha ) const
+{
+	// 睡眠的物体不再更新MotionState，直接用当前位置
+	btTransform transform = mBody->isActive() ? mMotionState->Interpolate( alpha ) : mBody->getWorldTransform();
+	float mat_val[16];
+	transform.getOpenGLMatrix( mat_val );
+	return glm::make_mat4x4( mat_val );
+}
+
+glm::vec3
+Physics::PhysicsObject::GetInterpolatedPosition( float alpha ) const
+{
+	const btVector3 origin = mBody->isActive() ? mMotionState->Interpolate( alpha ).getOrigin() : mBody->getWorldTransform().getOrigin();
+	return { origin.x(), origin.y(), origin.z() };
+}
+
+glm::vec3
+Physics::PhysicsObject::GetPreviousPosition() const
+{
+	// 睡眠的物体不再更新MotionState，上一步就是当前位置
+	const btVector3& origin = mBody->isActive() ? mMotionState->GetPrevious().getOrigin() : mBody->getWorldTransform().getOrigin();
+	return { origin.x(), origin.y(), origin.z() };
+}
+
 void 
 Physics::PhysicsObject::SetIgnoireCollisionWith( const btCollisionObject* obj, bool flag )
 {
+	// 传送门每次更新都会设置一遍，只有状态变化时才处理
+	// Bullet每次设置为true都会往忽略列表里加一项，而且睡眠的物体不会自己发现墙没了
+	const bool is_ignored = !mBody->checkCollideWith( obj );
+	if( is_ignored == flag )
+	{
+		return;
+	}
 	mBody->setIgnoreCollisionCheck( obj, flag );
+	mBody->activate( true );
 }
 
 bool 
@@ -228,10 +784,10 @@ Physics::PhysicsObject::GetAABB()
 ///
 /// Box implementation
 /// 
-Physics::Box::Box( glm::vec3 pos, glm::vec3 size, btDiscreteDynamicsWorld& world, Type type, int group, int mask, bool is_ghost, Callback callback )
-	: PhysicsObject( pos, world, type, std::move( callback ) )
+Physics::Box::Box( glm::vec3 pos, std::shared_ptr<btBoxShape> shape, Physics& physics, Type type, int group, int mask, bool is_ghost, Callback callback )
+	: PhysicsObject( pos, physics, type, std::move( callback ) )
 {
-	mShape = std::make_unique<btBoxShape>( btVector3( size.x / 2.f, size.y / 2.f, size.z / 2.f ) );
+	mShape = std::move( shape );
 	BuildRigidBody( std::move( pos ), mShape.get(), group, mask, is_ghost );
 }
 
@@ -241,10 +797,10 @@ Physics::Box::~Box()
 ///
 /// Capsule implementation
 /// 
-Physics::Capsule::Capsule( glm::vec3 pos, float raidus, float height, btDiscreteDynamicsWorld& world,Type type, int group, int mask, bool is_ghost, Callback callback )
-	: PhysicsObject( pos, world, type, std::move( callback ) )
+Physics::Capsule::Capsule( glm::vec3 pos, std::shared_ptr<btCapsuleShape> shape, Physics& physics, Type type, int group, int mask, bool is_ghost, Callback callback )
+	: PhysicsObject( pos, physics, type, std::move( callback ) )
 {
-	mShape = std::make_unique<btCapsuleShape>( raidus, height );
+	mShape = std::move( shape );
 	BuildRigidBody( std::move( pos ), mShape.get(), group, mask, is_ghost );
 }
 
@@ -252,63 +808,776 @@ Physics::Capsule::~Capsule()
 {}
 
 ///
-/// Physics class implementation
+/// Trigger implementation
 /// 
-Physics::Physics( Renderer& renderer )
-	: mPreviousUpdateTimepoint( std::chrono::steady_clock::now() )
-	, mRenderer( renderer )
-{}
-
-Physics::~Physics()
-{}
-
+Physics::Trigger::Trigger( glm::vec3 pos, std::shared_ptr<btBoxShape> shape, btDiscreteDynamicsWorld& world, int group, int mask )
+	: mWorld( world )
+	, mShape( std::move( shape ) )
+	, mGhostObject( std::make_unique<btPairCachingGhostObject>() )
+{
+	btTransform transform;
+	transform.setIdentity();
+	transform.setOrigin( btVector3( pos.x, pos.y, pos.z ) );
+	mGhostObject->setWorldTransform( transform );
+	mGhostObject->setCollisionShape( mShape.get() );
+	mGhostObject->setCollisionFlags( btCollisionObject::CF_STATIC_OBJECT | btCollisionObject::CF_NO_CONTACT_RESPONSE );
+	mWorld.addCollisionObject( mGhostObject.get(), group, mask );
+}
+
+Physics::Trigger::~Trigger()
+{
+	mWorld.removeCollisionObject( mGhostObject.get() );
+}
+
+void
+Physics::Trigger::SetTransform( glm::mat4 transform_mat )
+{
+	btTransform transform;
+	transform.setFromOpenGLMatrix( glm::value_ptr( transform_mat ) );
+	mGhostObject->setWorldTransform( transform );
+	mWorld.updateSingleAabb( mGhostObject.get() );
+}
+
+bool
+Physics::Trigger::IsContain( glm::vec3 point ) const
+{
+	// 转到盒子的本地空间，再和半边长比较
+	const btVector3 local = mGhostObject->getWorldTransform().invXform( btVector3( point.x, point.y, point.z ) );
+	const btVector3 half_extents = mShape->getHalfExtentsWithMargin();
+	return std::abs( local.x() ) <= half_extents.x() &&
+		   std::abs( local.y() ) <= half_extents.y() &&
+		   std::abs( local.z() ) <= half_extents.z();
+}
+
+bool
+Physics::Trigger::IsSegmentIntersecting( glm::vec3 from, glm::vec3 to ) const
+{
+	// 转到盒子的本地空间，对三组平行面做slab测试
+	const btTransform& transform = mGhostObject->getWorldTransform();
+	const btVector3 local_from = transform.invXform( btVector3( from.x, from.y, from.z ) );
+	const btVector3 local_to = transform.invXform( btVector3( to.x, to.y, to.z ) );
+	const btVector3 half_extents = mShape->getHalfExtentsWithMargin();
+	const btVector3 direction = local_to - local_from;
+
+	btScalar t_min = 0.f;
+	btScalar t_max = 1.f;
+	for( int axis = 0; axis < 3; axis++ )
+	{
+		if( std::abs( direction[ axis ] ) < SIMD_EPSILON )
+		{
+			if( std::abs( local_from[ axis ] ) > half_extents[ axis ] )
+			{
+				return false;
+			}
+			continue;
+		}
+		btScalar t0 = ( -half_extents[ axis ] - local_from[ axis ] ) / direction[ axis ];
+		btScalar t1 = ( half_extents[ axis ] - local_from[ axis ] ) / direction[ axis ];
+		if( t0 > t1 )
+		{
+			std::swap( t0, t1 );
+		}
+		t_min = std::max( t_min, t0 );
+		t_max = std::min( t_max, t1 );
+		if( t_min > t_max )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool
+Physics::Trigger::IsOverlapping( const btCollisionObject* obj ) const
+{
+	const btAlignedObjectArray<btCollisionObject*>& overlapping = mGhostObject->getOverlappingPairs();
+	return overlapping.findLinearSearch( const_cast<btCollisionObject*>( obj ) ) < overlapping.size();
+}
+
+int
+Physics::Trigger::GetNumOverlapping() const
+{
+	return mGhostObject->getNumOverlappingObjects();
+}
+
+const btCollisionObject*
+Physics::Trigger::GetOverlapping( int index ) const
+{
+	return mGhostObject->getOverlappingObject( index );
+}
+
+btCollisionObject*
+Physics::Trigger::GetCollisionObject()
+{
+	return mGhostObject.get();
+}
+
+AABB
+Physics::Trigger::GetAABB() const
+{
+	btVector3 max, min;
+	mShape->getAabb( mGhostObject->getWorldTransform(), min, max );
+	return {
+		{ max.x(), max.y(), max.z() },
+		{ min.x(), min.y(), min.z() }
+	};
+}
+
+///
+/// StaticCompound implementation
+/// 
+Physics::StaticCompound::StaticCompound( std::vector<Part> parts, Physics& physics, int group, int mask )
+	: PhysicsObject( glm::vec3( 0.f ), physics, Type::STATIC, {} )
+	, mParts( std::move( parts ) )
+	, mDetachedParts( mParts.size() )
+{
+	// 开启动态AABB树，射线和碰撞检测只需要检查附近的盒子
+	auto compound = std::make_shared<btCompoundShape>( true, static_cast<int>( mParts.size() ) );
+	for( size_t i = 0; i < mParts.size(); i++ )
+	{
+		const Part& part = mParts[i];
+		mChildShapes.push_back( mPhysics.GetBoxShape( part.size ) );
+
+		btTransform local_transform;
+		local_transform.setIdentity();
+		local_transform.setOrigin( btVector3( part.position.x, part.position.y, part.position.z ) );
+		compound->addChildShape( local_transform, mChildShapes.back().get() );
+		mChildToPart.push_back( static_cast<int>( i ) );
+	}
+	mShape = compound;
+	BuildRigidBody( glm::vec3( 0.f ), mShape.get(), group, mask, false );
+	mPhysics.mStaticCompounds.emplace( mBody.get(), this );
+}
+
+Physics::StaticCompound::~StaticCompound()
+{
+	mPhysics.mStaticCompounds.erase( mBody.get() );
+}
+
+const btCollisionObject*
+Physics::StaticCompound::Detach( int child_index )
+{
+	if( child_index < 0 || child_index >= static_cast<int>( mChildToPart.size() ) )
+	{
+		return mBody.get();
+	}
+
+	const int part_index = mChildToPart[ child_index ];
+	const Part& part = mParts[ part_index ];
+	mDetachedParts[ part_index ] = mPhysics.CreateBox( part.position, part.size, Type::STATIC, mGroup, mMask );
+
+	// btCompoundShape会把最后一个子形状移到被删除的位置，序号表也要跟着改
+	auto compound = static_cast<btCompoundShape*>( mShape.get() );
+	compound->removeChildShapeByIndex( child_index );
+	mChildToPart[ child_index ] = mChildToPart.back();
+	mChildToPart.pop_back();
+	mWorld.updateSingleAabb( mBody.get() );
+
+	return mDetachedParts[ part_index ]->GetCollisionObject();
+}
+
+int
+Physics::StaticCompound::GetNumChildren() const
+{
+	return static_cast<int>( mChildToPart.size() );
+}
+
+int
+Physics::StaticCompound::GetNumDetached() const
+{
+	return static_cast<int>( mParts.size() - mChildToPart.size() );
+}
+
+///
+/// Physics class implementation
+/// 
+Physics::Physics()
+	: mPreviousUpdateTimepoint( std::chrono::steady_clock::now() )
+	, mLastStepTimepoint( mPreviousUpdateTimepoint )
+	, mLastStepMs( 0.f )
+	, mLastBroadphaseMs( 0.f )
+	, mBroadphaseType( Broadphase::DBVT )
+	, mIsMeasuringBroadphase( false )
+	, mIsProfilingBullet( false )
+	, mWorldBounds( DEFAULT_WORLD_BOUNDS )
+	, mFixedTimeStep( 1.f / 60.f )
+	, mAccumulator( 0.f )
+	, mIsRealTime( false )
+	, mIsInterpolatingRealTime( false )
+	, mDebugDrawer( nullptr )
+	, mRemovedObjects( 0 )
+{}
+
+Physics::~Physics()
+{
+	if( mIsProfilingBullet )
+	{
+		bullet_profile::remove_user();
+	}
+	// 世界里的物体由各自的PhysicsObject移除，这里只需要确保之后没人再用我们的线程池
+	if( mTaskScheduler && btGetTaskScheduler() == mTaskScheduler.get() )
+	{
+		btSetTaskScheduler( btGetSequentialTaskScheduler() );
+	}
+}
+
 void 
-Physics::Initialize( float dt )
+Physics::Initialize( float dt, const Settings& settings )
 {
-	mConfiguration                     = std::make_unique<btDefaultCollisionConfiguration>();
-	mCollisionDispatcher               = std::make_unique<btCollisionDispatcher>( mConfiguration.get() );
-	mBroadphaseInterface               = std::make_unique<btDbvtBroadphase>();
-	mSequentialImpulseConstraintSolver = std::make_unique<btSequentialImpulseConstraintSolver>();
+	if( dt > 0.f )
+	{
+		mFixedTimeStep = dt;
+	}
+
+	int num_threads = settings.num_threads > 0 ? settings.num_threads : static_cast<int>( std::thread::hardware_concurrency() );
+#if !BT_THREADSAFE
+	if( num_threads > 1 )
+	{
+		std::cerr << "WARNING: Bullet is built without BT_THREADSAFE, multithreaded physics is disabled." << std::endl;
+		num_threads = 1;
+	}
+#endif
+
+	mConfiguration = std::make_unique<btDefaultCollisionConfiguration>();
+	mBroadphaseType = settings.broadphase;
+	mIsMeasuringBroadphase = settings.measure_broadphase;
+	if( settings.profile_bullet && !mIsProfilingBullet )
+	{
+		bullet_profile::add_user();
+		mIsProfilingBullet = true;
+	}
+	mBroadphaseInterface = CreateBroadphase( mWorldBounds );
+	mGhostPairCallback = std::make_unique<btGhostPairCallback>();
+	mBroadphaseInterface->getOverlappingPairCache()->setInternalGhostPairCallback( mGhostPairCallback.get() );
+
+	if( num_threads > 1 )
+	{
+		// Mt组件在创建时就会读取任务调度器的线程数，必须先设置
+		mTaskScheduler = std::make_unique<PhysicsTaskScheduler>( num_threads );
+		btSetTaskScheduler( mTaskScheduler.get() );
+
+		mCollisionDispatcher = std::make_unique<btCollisionDispatcherMt>( mConfiguration.get() );
+		mConstraintSolverPool = std::make_unique<btConstraintSolverPoolMt>( mTaskScheduler->getNumThreads() );
+		// 大的模拟岛交给一个多线程求解器，小的岛由求解器池并行处理
+		mConstraintSolver = std::make_unique<btSequentialImpulseConstraintSolverMt>();
+
+		mWorld = std::make_unique<btDiscreteDynamicsWorldMt>(
+			mCollisionDispatcher.get(),
+			mBroadphaseInterface.get(),
+			mConstraintSolverPool.get(),
+			mConstraintSolver.get(),
+			mConfiguration.get() );
+	}
+	else
+	{
+		mCollisionDispatcher = std::make_unique<btCollisionDispatcher>( mConfiguration.get() );
+		mConstraintSolver = std::make_unique<btSequentialImpulseConstraintSolver>();
 
-	mWorld = std::make_unique<btDiscreteDynamicsWorld>( 
-		mCollisionDispatcher.get(), 
-		mBroadphaseInterface.get(), 
-		mSequentialImpulseConstraintSolver.get(), 
-		mConfiguration.get() );
+		mWorld = std::make_unique<btDiscreteDynamicsWorld>( 
+			mCollisionDispatcher.get(), 
+			mBroadphaseInterface.get(), 
+			mConstraintSolver.get(), 
+			mConfiguration.get() );
+	}
 
 	mWorld->setGravity( btVector3( 0, -20, 0 ) );
-	mDebugRenderer = std::make_unique<DebugRenderer>( mRenderer );
-	mWorld->setDebugDrawer( mDebugRenderer.get() );
+	mWorld->setDebugDrawer( mDebugDrawer );
 }
 
 void 
 Physics::Update()
 {
+	PORTAL_PROFILE_SCOPE( "Physics::Update" );
 	auto current_time = std::chrono::steady_clock::now();
 	float delta_seconds = std::chrono::duration<float, std::milli>( current_time - mPreviousUpdateTimepoint ).count() / 1000.f;
 	mPreviousUpdateTimepoint = current_time;
 
-	mWorld->stepSimulation( delta_seconds, 10 );
+	Step( delta_seconds );
+	mIsRealTime = true;
+}
+
+void
+Physics::Step( float elapsed_seconds )
+{
+	auto step_begin = std::chrono::steady_clock::now();
+	mLastStepTimepoint = step_begin;
+	mIsRealTime = false;
+	mLastBroadphaseMs = 0.f;
+	mLastStepProfile = StepProfile{};
+	bullet_profile::StepScope profile_scope( mIsProfilingBullet ? &mLastStepProfile : nullptr );
+
+	if( elapsed_seconds > MAX_FRAME_TIME )
+	{
+		elapsed_seconds = MAX_FRAME_TIME;
+		mStepStats.clamped_frames++;
+	}
+	mAccumulator += std::max( elapsed_seconds, 0.f );
+
+	int num_steps = 0;
+	while( mAccumulator >= mFixedTimeStep && num_steps < MAX_STEPS_PER_UPDATE )
+	{
+		// maxSubSteps为0时Bullet直接模拟一步，不再用自己的累加器和插值
+		mWorld->stepSimulation( mFixedTimeStep, 0 );
+		DispatchContactEvents();
+		mAccumulator -= mFixedTimeStep;
+		num_steps++;
+	}
+	mStepStats.steps += num_steps;
+
+	if( mAccumulator >= mFixedTimeStep )
+	{
+		const uint64_t dropped_steps = static_cast<uint64_t>( mAccumulator / mFixedTimeStep );
+		mStepStats.dropped_steps += dropped_steps;
+		mAccumulator -= dropped_steps * mFixedTimeStep;
+	}
+
+	mLastStepMs = std::chrono::duration<float, std::milli>( std::chrono::steady_clock::now() - step_begin ).count();
+}
+
+int
+Physics::GetNumThreads() const
+{
+	return mTaskScheduler ? mTaskScheduler->getNumThreads() : 1;
+}
+
+void
+Physics::SetWorldBounds( const AABB& bounds )
+{
+	mWorldBounds = bounds;
+	if( mBroadphaseType == Broadphase::DBVT || !mWorld )
+	{
+		return;
+	}
+
+	// 先把所有物体从旧的broadphase里拿出来，代理是由旧的broadphase销毁的
+	struct Entry
+	{
+		btCollisionObject* object;
+		int group;
+		int mask;
+	};
+	std::vector<Entry> entries;
+	const btCollisionObjectArray& objects = mWorld->getCollisionObjectArray();
+	entries.reserve( objects.size() );
+	for( int i = 0; i < objects.size(); i++ )
+	{
+		const btBroadphaseProxy* proxy = objects[i]->getBroadphaseHandle();
+		entries.push_back( { objects[i], proxy->m_collisionFilterGroup, proxy->m_collisionFilterMask } );
+	}
+	for( auto& entry : entries )
+	{
+		if( btRigidBody* body = btRigidBody::upcast( entry.object ) )
+		{
+			mWorld->removeRigidBody( body );
+		}
+		else
+		{
+			mWorld->removeCollisionObject( entry.object );
+		}
+	}
+
+	auto broadphase = CreateBroadphase( mWorldBounds );
+	broadphase->getOverlappingPairCache()->setInternalGhostPairCallback( mGhostPairCallback.get() );
+	mWorld->setBroadphase( broadphase.get() );
+	mBroadphaseInterface = std::move( broadphase );
+
+	// 按原来的顺序加回去，保持模拟结果的确定性
+	for( auto& entry : entries )
+	{
+		if( btRigidBody* body = btRigidBody::upcast( entry.object ) )
+		{
+			mWorld->addRigidBody( body, entry.group, entry.mask );
+		}
+		else
+		{
+			mWorld->addCollisionObject( entry.object, entry.group, entry.mask );
+		}
+	}
+}
+
+Broadphase
+Physics::GetBroadphase() const
+{
+	return mBroadphaseType;
+}
+
+std::unique_ptr<btBroadphaseInterface>
+Physics::CreateBroadphase( const AABB& bounds )
+{
+	const btVector3 world_min( bounds.min.x, bounds.min.y, bounds.min.z );
+	const btVector3 world_max( bounds.max.x, bounds.max.y, bounds.max.z );
+	std::unique_ptr<btBroadphaseInterface> broadphase;
+	switch( mBroadphaseType )
+	{
+	case Broadphase::AXIS_SWEEP:
+		broadphase = std::make_unique<btAxisSweep3>( world_min, world_max );
+		break;
+	case Broadphase::AXIS_SWEEP_32:
+		broadphase = std::make_unique<bt32BitAxisSweep3>( world_min, world_max, AXIS_SWEEP_32_MAX_HANDLES );
+		break;
+	case Broadphase::DBVT:
+	default:
+		broadphase = std::make_unique<btDbvtBroadphase>();
+		break;
+	}
+	if( mIsMeasuringBroadphase )
+	{
+		broadphase = std::make_unique<TimedBroadphase>( std::move( broadphase ), mLastBroadphaseMs );
+	}
+	return broadphase;
+}
+
+float
+Physics::GetLastStepMs() const
+{
+	return mLastStepMs;
+}
+
+float
+Physics::GetLastBroadphaseMs() const
+{
+	return mLastBroadphaseMs;
+}
+
+const Physics::StepProfile&
+Physics::GetLastStepProfile() const
+{
+	return mLastStepProfile;
+}
+
+float
+Physics::GetInterpolationAlpha() const
+{
+	float pending_seconds = mAccumulator;
+	if( mIsRealTime )
+	{
+		pending_seconds += std::chrono::duration<float>( std::chrono::steady_clock::now() - mPreviousUpdateTimepoint ).count();
+	}
+	else if( mIsInterpolatingRealTime )
+	{
+		pending_seconds += std::chrono::duration<float>( std::chrono::steady_clock::now() - mLastStepTimepoint ).count();
+	}
+	return glm::clamp( pending_seconds / mFixedTimeStep, 0.f, 1.f );
+}
+
+void
+Physics::SetRealTimeInterpolation( bool enabled )
+{
+	mIsInterpolatingRealTime = enabled;
+}
+
+const Physics::StepStats&
+Physics::GetStepStats() const
+{
+	return mStepStats;
+}
+
+void
+Physics::SaveSnapshot( Snapshot& snapshot ) const
+{
+	snapshot.mObjects = mMovingObjects;
+	snapshot.mStates.resize( mMovingObjects.size() );
+	snapshot.mRemovedObjects = mRemovedObjects;
+	snapshot.mAccumulator = mAccumulator;
+	for( size_t i = 0; i < mMovingObjects.size(); i++ )
+	{
+		const PhysicsObject& object = *mMovingObjects[i];
+		const btRigidBody& body = *object.mBody;
+		Snapshot::ObjectState& state = snapshot.mStates[i];
+		body.getWorldTransform().serializeFloat( state.transform );
+		object.mMotionState->GetPrevious().serializeFloat( state.previous_transform );
+		body.getLinearVelocity().serializeFloat( state.linear_velocity );
+		body.getAngularVelocity().serializeFloat( state.angular_velocity );
+		state.deactivation_time = body.getDeactivationTime();
+		state.activation_state = body.getActivationState();
+		state.is_simulated = object.mIsSimulated ? 1 : 0;
+	}
+}
+
+bool
+Physics::IsSnapshotValid( const Snapshot& snapshot ) const
+{
+	return snapshot.mRemovedObjects == mRemovedObjects;
+}
+
+bool
+Physics::RestoreSnapshot( const Snapshot& snapshot )
+{
+	if( !IsSnapshotValid( snapshot ) )
+	{
+		std::cerr << "WARNING: Physics snapshot is stale, objects were destroyed after it was saved." << std::endl;
+		return false;
+	}
+
+	btOverlappingPairCache* pair_cache = mBroadphaseInterface->getOverlappingPairCache();
+	for( size_t i = 0; i < snapshot.mObjects.size(); i++ )
+	{
+		PhysicsObject& object = *snapshot.mObjects[i];
+		const Snapshot::ObjectState& state = snapshot.mStates[i];
+		btRigidBody& body = *object.mBody;
+		object.SetSimulated( state.is_simulated != 0 );
+
+		btTransform transform;
+		btTransform previous_transform;
+		btVector3 linear_velocity;
+		btVector3 angular_velocity;
+		transform.deSerializeFloat( state.transform );
+		previous_transform.deSerializeFloat( state.previous_transform );
+		linear_velocity.deSerializeFloat( state.linear_velocity );
+		angular_velocity.deSerializeFloat( state.angular_velocity );
+
+		object.mMotionState->Restore( previous_transform, transform );
+		body.setWorldTransform( transform );
+		body.setInterpolationWorldTransform( transform );
+		body.setLinearVelocity( linear_velocity );
+		body.setAngularVelocity( angular_velocity );
+		body.setInterpolationLinearVelocity( linear_velocity );
+		body.setInterpolationAngularVelocity( angular_velocity );
+		body.clearForces();
+		body.forceActivationState( state.activation_state );
+		body.setDeactivationTime( state.deactivation_time );
+
+		if( object.mIsSimulated )
+		{
+			// 旧位置上的接触点不能再用
+			mWorld->updateSingleAabb( &body );
+			pair_cache->cleanProxyFromPairs( body.getBroadphaseHandle(), mCollisionDispatcher.get() );
+		}
+	}
+	mAccumulator = snapshot.mAccumulator;
+	return true;
+}
+
+size_t
+Physics::Snapshot::GetNumObjects() const
+{
+	return mStates.size();
+}
+
+size_t
+Physics::Snapshot::GetSizeBytes() const
+{
+	return mStates.size() * sizeof( ObjectState ) + mObjects.size() * sizeof( PhysicsObject* );
 }
 
 std::unique_ptr<Physics::Box>
 Physics::CreateBox( glm::vec3 pos, glm::vec3 size, PhysicsObject::Type type, int group, int mask, bool is_ghost, physics::Callback callback )
 {
-	return std::make_unique<Physics::Box>( pos, size, *mWorld, type, group, mask, is_ghost, std::move( callback ) );
+	auto box = std::make_unique<Physics::Box>( pos, GetBoxShape( size ), *this, type, group, mask, is_ghost, std::move( callback ) );
+	RegisterContactListener( *box );
+	return box;
 }
 
 std::unique_ptr<Physics::Capsule>
 Physics::CreateCapsule( glm::vec3 pos, float raidus, float height, PhysicsObject::Type type, int group, int mask, bool is_ghost, physics::Callback callback )
 {
-	return std::make_unique<Physics::Capsule>( pos, raidus, height, *mWorld, type, group, mask, is_ghost, std::move( callback ) );
+	auto capsule = std::make_unique<Physics::Capsule>( pos, GetCapsuleShape( raidus, height ), *this, type, group, mask, is_ghost, std::move( callback ) );
+	RegisterContactListener( *capsule );
+	return capsule;
+}
+
+template<>
+ObjectPool<btBoxShape>&
+Physics::GetShapePool<btBoxShape>()
+{
+	return mBoxShapePool;
 }
+
+template<>
+ObjectPool<btCapsuleShape>&
+Physics::GetShapePool<btCapsuleShape>()
+{
+	return mCapsuleShapePool;
+}
+
+template<typename Shape, typename... Args>
+std::shared_ptr<Shape>
+Physics::GetCachedShape( const ShapeKey& key, Args&&... args )
+{
+	auto cached = mShapeCache.find( key );
+	if( cached != mShapeCache.end() )
+	{
+		if( auto shape = cached->second.lock() )
+		{
+			return std::static_pointer_cast<Shape>( std::move( shape ) );
+		}
+	}
+
+	// 没有可用的形状时才会走到这里，顺便清掉已经没人用的项，不然尺寸各异的物体会让缓存一直变大
+	for( auto itr = mShapeCache.begin(); itr != mShapeCache.end(); )
+	{
+		itr = itr->second.expired() ? mShapeCache.erase( itr ) : std::next( itr );
+	}
+
+	// 最后一个使用者放手时形状还回内存池
+	ObjectPool<Shape>& pool = GetShapePool<Shape>();
+	std::shared_ptr<Shape> shape( pool.Create( std::forward<Args>( args )... ), typename ObjectPool<Shape>::Deleter{ &pool } );
+	mShapeCache[ key ] = shape;
+	return shape;
+}
+
+void
+Physics::RegisterContactListener( PhysicsObject& object )
+{
+	if( !object.mCallback )
+	{
+		return;
+	}
+	mContactListeners[ object.mBody.get() ] = &object;
+	object.mContactDispatcher = this;
+}
+
+void
+Physics::UnregisterContactListener( PhysicsObject& object )
+{
+	mContactListeners.erase( object.mBody.get() );
+	object.mContactDispatcher = nullptr;
+}
+
+void
+Physics::RemoveContactPairs( PhysicsObject& object, bool notify_self )
+{
+	// 地址可能马上被新物体复用，不能留在上一步的接触里
+	const btCollisionObject* body = object.mBody.get();
+	auto removed = std::stable_partition( mContactPairs.begin(), mContactPairs.end(),
+		[body]( const ContactPair& pair ) { return pair.first != body && pair.second != body; } );
+	if( removed == mContactPairs.end() )
+	{
+		return;
+	}
+	std::vector<PendingContactEvent> events;
+	for( auto pair = removed; pair != mContactPairs.end(); ++pair )
+	{
+		const btCollisionObject* other = pair->first == body ? pair->second : pair->first;
+		events.push_back( { ContactEvent::END, other, body } );
+		if( notify_self )
+		{
+			events.push_back( { ContactEvent::END, body, other } );
+		}
+	}
+	mContactPairs.erase( removed, mContactPairs.end() );
+
+	// 可能是在分发的回调里销毁的物体，不能用mPendingContactEvents
+	for( auto& pending : events )
+	{
+		auto listener = mContactListeners.find( pending.object );
+		if( listener != mContactListeners.end() )
+		{
+			listener->second->mCallback( pending.event, pending.other );
+		}
+	}
+}
+
+void
+Physics::DispatchContactEvents()
+{
+	PORTAL_PROFILE_SCOPE( "Physics::DispatchContactEvents" );
+	if( mContactListeners.empty() && mContactPairs.empty() )
+	{
+		return;
+	}
+
+	// 收集这一步至少有一方登记了回调的接触对
+	mCurrentContactPairs.clear();
+	const int num_manifolds = mCollisionDispatcher->getNumManifolds();
+	for( int i = 0; i < num_manifolds; i++ )
+	{
+		const btPersistentManifold* manifold = mCollisionDispatcher->getManifoldByIndexInternal( i );
+		if( manifold->getNumContacts() == 0 )
+		{
+			continue;
+		}
+		const btCollisionObject* a = manifold->getBody0();
+		const btCollisionObject* b = manifold->getBody1();
+		if( mContactListeners.count( a ) == 0 && mContactListeners.count( b ) == 0 )
+		{
+			continue;
+		}
+		mCurrentContactPairs.emplace_back( std::min( a, b ), std::max( a, b ) );
+	}
+	std::sort( mCurrentContactPairs.begin(), mCurrentContactPairs.end() );
+	mCurrentContactPairs.erase( std::unique( mCurrentContactPairs.begin(), mCurrentContactPairs.end() ), mCurrentContactPairs.end() );
+
+	// 两个有序数组一起走一遍：只在这一步的是BEGIN，两步都有的是STAY，只在上一步的是END
+	mPendingContactEvents.clear();
+	auto add_events = [this]( ContactEvent event, const ContactPair& pair )
+	{
+		mPendingContactEvents.push_back( { event, pair.first, pair.second } );
+		mPendingContactEvents.push_back( { event, pair.second, pair.first } );
+	};
+	auto current = mCurrentContactPairs.begin();
+	auto previous = mContactPairs.begin();
+	while( current != mCurrentContactPairs.end() || previous != mContactPairs.end() )
+	{
+		if( previous == mContactPairs.end() || ( current != mCurrentContactPairs.end() && *current < *previous ) )
+		{
+			add_events( ContactEvent::BEGIN, *current++ );
+		}
+		else if( current == mCurrentContactPairs.end() || *previous < *current )
+		{
+			add_events( ContactEvent::END, *previous++ );
+		}
+		else
+		{
+			add_events( ContactEvent::STAY, *current++ );
+			previous++;
+		}
+	}
+	mContactPairs.swap( mCurrentContactPairs );
+
+	// 回调里可能会销毁物体，每次都重新查一下物体还在不在
+	for( auto& pending : mPendingContactEvents )
+	{
+		auto listener = mContactListeners.find( pending.object );
+		if( listener != mContactListeners.end() )
+		{
+			listener->second->mCallback( pending.event, pending.other );
+		}
+	}
+}
+
+std::unique_ptr<Physics::Trigger>
+Physics::CreateTrigger( glm::vec3 pos, glm::vec3 size, int group, int mask )
+{
+	return std::make_unique<Physics::Trigger>( pos, GetBoxShape( size ), *mWorld, group, mask );
+}
+
+std::unique_ptr<Physics::StaticCompound>
+Physics::CreateStaticCompound( std::vector<StaticCompound::Part> parts, int group, int mask )
+{
+	return std::make_unique<Physics::StaticCompound>( std::move( parts ), *this, group, mask );
+}
+
+std::shared_ptr<btBoxShape>
+Physics::GetBoxShape( glm::vec3 size )
+{
+	const glm::vec3 half_extents = size / 2.f;
+	return GetCachedShape<btBoxShape>(
+		ShapeKey{ BOX_SHAPE_PROXYTYPE, half_extents.x, half_extents.y, half_extents.z },
+		btVector3( half_extents.x, half_extents.y, half_extents.z ) );
+}
+
+std::shared_ptr<btCapsuleShape>
+Physics::GetCapsuleShape( float raidus, float height )
+{
+	return GetCachedShape<btCapsuleShape>(
+		ShapeKey{ CAPSULE_SHAPE_PROXYTYPE, raidus, height, 0.f },
+		raidus, height );
+}
+
+size_t
+Physics::GetCachedShapeCount() const
+{
+	return std::count_if( mShapeCache.begin(), mShapeCache.end(), []( auto& entry ) { return !entry.second.expired(); } );
+}
+
  
 void 
-Physics::CastRay( glm::vec3 from, glm::vec3 to, int filter_group, std::function<void(bool, glm::vec3, glm::vec3, const btCollisionObject* )> callback )
+Physics::CastRay( glm::vec3 from, glm::vec3 to, int filter_group, std::function<void(bool, glm::vec3, glm::vec3, const btCollisionObject*, int )> callback )
 {
 	btVector3 from_v{ from.x, from.y, from.z };
 	btVector3 to_v{ to.x, to.y, to.z };
-	btCollisionWorld::ClosestRayResultCallback first_result( from_v, to_v );
+	ClosestRayChildResultCallback first_result( from_v, to_v );
 	first_result.m_collisionFilterGroup = filter_group;
 	mWorld->rayTest( from_v, to_v, first_result );
 
@@ -318,13 +1587,49 @@ Physics::CastRay( glm::vec3 from, glm::vec3 to, int filter_group, std::function<
 			first_result.hasHit(),
 			{ first_result.m_hitPointWorld.x(), first_result.m_hitPointWorld.y(), first_result.m_hitPointWorld.z() },
 			{ first_result.m_hitNormalWorld.x(), first_result.m_hitNormalWorld.y(), first_result.m_hitNormalWorld.z() },
-			first_result.m_collisionObject
+			first_result.m_collisionObject,
+			first_result.m_childIndex
 		);
 	}
 }
 
+const btCollisionObject*
+Physics::ResolveAttachSurface( const btCollisionObject* hit_object, int child_index )
+{
+	// 击中合并的静态墙时，把那面墙拆出来，这样传送门可以只关闭这一面墙的碰撞
+	auto compound = hit_object ? mStaticCompounds.find( hit_object ) : mStaticCompounds.end();
+	if( compound == mStaticCompounds.end() )
+	{
+		return hit_object;
+	}
+	return compound->second->Detach( child_index );
+}
+
+void
+Physics::ActivateInRegion( const AABB& region )
+{
+	ActivateAabbCallback callback;
+	mBroadphaseInterface->aabbTest(
+		btVector3( region.min.x, region.min.y, region.min.z ),
+		btVector3( region.max.x, region.max.y, region.max.z ),
+		callback );
+}
+
+void
+Physics::SetDebugDrawer( btIDebugDraw* debug_drawer )
+{
+	mDebugDrawer = debug_drawer;
+	if( mWorld )
+	{
+		mWorld->setDebugDrawer( mDebugDrawer );
+	}
+}
+
 void
 Physics::DebugRender()
 {
-	mWorld->debugDrawWorld();
+	if( mDebugDrawer )
+	{
+		mWorld->debugDrawWorld();
+	}
 }
@@ -4,17 +4,24 @@
 #include <memory>
 #include <functional>
 #include <chrono>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <tuple>
 #include <glm/vec3.hpp>
 #include <glm/mat4x4.hpp>
 
 #include <bullet/btBulletCollisionCommon.h>
 #include <bullet/btBulletDynamicsCommon.h>
+#include <bullet/LinearMath/btThreads.h>
+#include <bullet/BulletCollision/CollisionDispatch/btGhostObject.h>
+#include <bullet/BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h>
+
+#include "ObjectPool.h"
 
 
 namespace portal
 {
-	class Renderer;
-
 	namespace physics
 	{
 		struct AABB
@@ -30,8 +37,19 @@ namespace portal
 			}
 		};
 
+		///
+		/// 接触事件的类型
+		/// 
+		enum class ContactEvent
+		{
+			BEGIN,  //< 这一步开始接触
+			STAY,   //< 上一步和这一步都在接触
+			END     //< 上一步还在接触，这一步分开了
+		};
+
 		///
 		/// 物体碰撞回调
+		/// 每一步物理模拟之后由Physics统一调用，见Physics::Step()
 		/// 
 		class Callback
 		{
@@ -43,16 +61,126 @@ namespace portal
 			/// 构造函数
 			/// 
 			/// @param callback
-			///		碰撞发生时调用
+			///		开始接触时以true调用，分开时以false调用
 			/// 
 			Callback( std::function<void(bool)> callback );
+
+			///
+			/// 构造函数
+			/// 
+			/// @param callback
+			///		每一步对每个接触的物体调用，参数是事件类型和另一个物体
+			/// 
+			Callback( std::function<void(ContactEvent, const btCollisionObject*)> callback );
 			~Callback();
 
+			explicit operator bool() const;
+
+			void operator()( ContactEvent event, const btCollisionObject* other ) const;
+
 		private:
-			std::function<void(bool)> mCallback;
+			std::function<void(ContactEvent, const btCollisionObject*)> mCallback;
+		};
+
+		///
+		/// broadphase的实现
+		/// 
+		enum class Broadphase
+		{
+			DBVT,          ///< btDbvtBroadphase，动态AABB树，不需要世界边界
+			AXIS_SWEEP,    ///< btAxisSweep3，有边界的sweep and prune，最多16384个物体
+			AXIS_SWEEP_32, ///< bt32BitAxisSweep3，同上，坐标量化更精细，物体数量上限更高
 		};
 
-		class DebugRenderer;
+		///
+		/// 所有的broadphase，对比测试按这个顺序运行
+		/// 
+		constexpr Broadphase ALL_BROADPHASES[] = { Broadphase::DBVT, Broadphase::AXIS_SWEEP, Broadphase::AXIS_SWEEP_32 };
+
+		///
+		/// 命令行和输出里用的名字：dbvt, sap, sap32
+		/// 
+		const char* GetBroadphaseName( Broadphase broadphase );
+
+		///
+		/// 按名字查找broadphase
+		/// 
+		/// @return
+		///		名字不认识时返回false，broadphase不变
+		/// 
+		bool ParseBroadphaseName( const char* name, Broadphase& broadphase );
+
+		///
+		/// 物理世界的配置
+		/// 
+		struct Settings
+		{
+			///
+			/// 物理模拟使用的线程数
+			/// 1是原来的单线程世界；大于1或者0（使用所有CPU核心）时使用btDiscreteDynamicsWorldMt，
+			/// 碰撞检测、约束求解和积分分到线程池里执行
+			/// 
+			/// 多线程需要Bullet编译时定义BT_THREADSAFE=1（CMake选项PORTAL_BULLET_MT），否则退回单线程
+			/// 
+			int num_threads = 1;
+
+			///
+			/// broadphase的实现
+			/// 关卡都是有边界的盒子，AXIS_SWEEP需要用SetWorldBounds()给出关卡的范围
+			/// 
+			Broadphase broadphase = Broadphase::DBVT;
+
+			///
+			/// 统计每一步broadphase更新AABB和计算重叠对的耗时，见GetLastBroadphaseMs()
+			/// broadphase外面会多包一层计时，只在压力测试时打开
+			/// 
+			bool measure_broadphase = false;
+
+			///
+			/// 接管Bullet内部的BT_PROFILE区间（btSetCustomEnterProfileZoneFunc()），统计每一步各阶段的耗时，见GetLastStepProfile()
+			/// 分析器开启时这些区间也会记录到trace里，显示在Physics::Update下面
+			/// 
+			bool profile_bullet = false;
+		};
+
+		///
+		/// 记录刚体最近两步物理模拟后的位置
+		/// Bullet每模拟一步会对活动的刚体调用一次setWorldTransform()，
+		/// 渲染时在这两个位置之间插值，画面就不会因为渲染和物理频率不同而抖动
+		/// 
+		class MotionState : public btMotionState
+		{
+		public:
+			MotionState( const btTransform& transform );
+
+			virtual void getWorldTransform( btTransform& transform ) const override;
+			virtual void setWorldTransform( const btTransform& transform ) override;
+
+			///
+			/// 物体被直接移动（比如传送）时调用，之后不会从旧位置插值过来
+			/// 
+			void Reset( const btTransform& transform );
+
+			///
+			/// 恢复快照时调用，上一步和当前步的变换都用快照里的
+			/// 
+			void Restore( const btTransform& previous, const btTransform& current );
+
+			///
+			/// @param alpha [0.0 - 1.0]
+			///		0是上一步的位置，1是当前位置
+			/// 
+			btTransform Interpolate( float alpha ) const;
+
+			///
+			/// 上一步模拟结束时的变换
+			/// 
+			const btTransform& GetPrevious() const;
+
+		private:
+			btTransform mPrevious;
+			btTransform mCurrent;
+		};
 
 		///
 		/// 物理主类
@@ -133,11 +261,44 @@ namespace portal
 				/// 
 				void Activate();
 
+				///
+				/// 物体是否醒着，睡眠的物体位置不会变化
+				/// 
+				bool IsActive() const;
+
+				///
+				/// 把物体移出/放回物理世界，移出后不参与模拟和碰撞，但刚体和形状都保留着
+				/// 给对象池暂时不用的物体使用
+				/// 
+				void SetSimulated( bool simulated );
+				bool IsSimulated() const;
+
 				void SetTransform( glm::mat4 transform_mat );
 				glm::mat4 GetTransform();
 
+				///
+				/// 渲染用的变换矩阵，在上一步和当前步的物理结果之间插值
+				/// 
+				/// @param alpha
+				///		Physics::GetInterpolationAlpha()
+				/// 
+				glm::mat4 GetInterpolatedTransform( float alpha ) const;
+				glm::vec3 GetInterpolatedPosition( float alpha ) const;
+
+				///
+				/// 上一步物理模拟结束时的位置，和GetPosition()连起来就是这一步扫过的线段
+				/// 
+				glm::vec3 GetPreviousPosition() const;
+
+				///
+				/// 开关和另一个物体的碰撞，状态有变化时会唤醒物体
+				/// 
 				void SetIgnoireCollisionWith( const btCollisionObject* obj, bool flag );
 
+				///
+				/// 立即对两个物体做一次完整的碰撞检测，开销很大
+				/// 每帧都要知道的接触请用创建时传入的physics::Callback
+				/// 
 				bool IsCollideWith( btCollisionObject* obj );
 
 				btCollisionObject* GetCollisionObject();
@@ -151,16 +312,17 @@ namespace portal
 				/// @param pos
 				///		位置
 				/// 
-				/// @param world
-				///		Reference to btDiscreteDynamicsWorld
+				/// @param physics
+				///		Reference to Physics，刚体和运动状态从它的内存池里分配
 				/// 
 				/// @param type
 				///		刚体类型
 				/// @param callback
 				///		本物体发生碰撞时调用的回调函数，必须确保Update()有定期被调用
+				///		由Physics::CreateBox()/CreateCapsule()登记到接触事件的分发里
 				/// 
 				PhysicsObject( glm::vec3 pos,
-							   btDiscreteDynamicsWorld& world,
+							   Physics& physics,
 							   Type type,
 
 							   physics::Callback callback );
@@ -186,11 +348,25 @@ namespace portal
 				/// 
 				void BuildRigidBody( glm::vec3 pos, btCollisionShape* collision_shape, int group, int mask, bool is_ghost );
 
+				///
+				/// 开启连续碰撞检测（扫掠球），防止快速物体一步穿过薄墙
+				/// 阈值按形状最薄的方向计算：一步移动超过半个厚度时才做扫掠
+				/// 
+				void EnableContinuousCollision( btCollisionShape* collision_shape );
+
+				friend class Physics; //< 接触事件的登记和分发
+
+				Physics& mPhysics;
 				btDiscreteDynamicsWorld& mWorld;
 				Type mType;
+				int mGroup;
+				int mMask;
+				bool mIsSimulated;                        //< 刚体是否在物理世界里
 				physics::Callback mCallback;
-				std::unique_ptr<btRigidBody> mBody;
-				std::unique_ptr<btCollisionShape> mShape;
+				Physics* mContactDispatcher;              //< 登记了接触事件的Physics，没有登记时为nullptr
+				std::shared_ptr<btCollisionShape> mShape; //< 可能和其他物体共用，见Physics::GetBoxShape()
+				ObjectPool<MotionState>::Ptr mMotionState;
+				ObjectPool<btRigidBody>::Ptr mBody;
 			};
 
 			///
@@ -206,11 +382,11 @@ namespace portal
 				/// @param pos
 				///		中心位置
 				/// 
-				/// @param size
-				///		长宽高
+				/// @param shape
+				///		盒子形状，从Physics::GetBoxShape()获取
 				/// 
-				/// @param world
-				///		Reference to btDiscreteDynamicsWorld
+				/// @param physics
+				///		Reference to Physics，刚体和运动状态从它的内存池里分配
 				/// 
 				/// @param type
 				///		刚体类型
@@ -225,8 +401,8 @@ namespace portal
 				///		本物体发生碰撞时调用的回调函数，必须确保Update()有定期被调用
 				///  
 				Box( glm::vec3 pos, 
-					 glm::vec3 size, 
-					 btDiscreteDynamicsWorld& world,
+					 std::shared_ptr<btBoxShape> shape, 
+					 Physics& physics,
 					 Type type,
 					 int group,
 					 int mask,
@@ -248,14 +424,11 @@ namespace portal
 				/// @param pos
 				///		中心位置
 				/// 
-				/// @param raidus
-				///		胶囊两头球形的半径
+				/// @param shape
+				///		胶囊形状，从Physics::GetCapsuleShape()获取
 				/// 
-				/// @param height
-				///		胶囊身体的长度
-				/// 
-				/// @param world
-				///		Reference to btDiscreteDynamicsWorld
+				/// @param physics
+				///		Reference to Physics，刚体和运动状态从它的内存池里分配
 				/// 
 				/// @param type
 				///		刚体类型
@@ -270,9 +443,8 @@ namespace portal
 				///		本物体发生碰撞时调用的回调函数，必须确保Update()有定期被调用
 				///  
 				Capsule( glm::vec3 pos, 
-						 float raidus, 
-						 float height, 
-						 btDiscreteDynamicsWorld& world, 
+						 std::shared_ptr<btCapsuleShape> shape, 
+						 Physics& physics, 
 						 Type type,
 						 int group,
 						 int mask,
@@ -281,11 +453,182 @@ namespace portal
 				~Capsule();
 			};
 
-		public:
 			///
-			/// 构造函数
+			/// 盒子型触发区
+			/// 只检测重叠，不参与物理模拟。底层是btPairCachingGhostObject，和它AABB重叠的物体列表
+			/// 由broadphase在物理模拟时维护，不需要每帧对所有物体做检测。
+			/// 列表只是AABB重叠，物体是否真的在触发区里用IsContain()按盒子的实际朝向判断
+			/// 使用Physics::CreateTrigger来创建实例
+			/// 
+			class Trigger
+			{
+			public:
+				///
+				/// 构造函数
+				/// 
+				/// @param pos
+				///		中心位置
+				/// 
+				/// @param shape
+				///		盒子形状，从Physics::GetBoxShape()获取
+				/// 
+				/// @param world
+				///		Reference to btDiscreteDynamicsWorld
+				///
+				/// @param group
+				///		触发区的分组
+				/// 
+				/// @param mask
+				///		触发区的掩码，只有匹配的物体才会出现在重叠列表里
+				/// 
+				Trigger( glm::vec3 pos,
+						 std::shared_ptr<btBoxShape> shape,
+						 btDiscreteDynamicsWorld& world,
+						 int group,
+						 int mask );
+				~Trigger();
+
+				void SetTransform( glm::mat4 transform_mat );
+
+				///
+				/// 点是否在触发区的盒子里（按盒子的朝向，不是AABB）
+				/// 
+				bool IsContain( glm::vec3 point ) const;
+
+				///
+				/// 线段是否穿过触发区的盒子（按盒子的朝向）
+				/// 一步就穿过触发区的快速物体用它来检测
+				/// 
+				bool IsSegmentIntersecting( glm::vec3 from, glm::vec3 to ) const;
+
+				///
+				/// 物体是否在上一次物理模拟后的重叠列表里
+				/// 
+				bool IsOverlapping( const btCollisionObject* obj ) const;
+
+				///
+				/// 重叠列表，在物理模拟时更新
+				/// 
+				int GetNumOverlapping() const;
+				const btCollisionObject* GetOverlapping( int index ) const;
+
+				btCollisionObject* GetCollisionObject();
+
+				AABB GetAABB() const;
+
+			private:
+				btDiscreteDynamicsWorld& mWorld;
+				std::shared_ptr<btBoxShape> mShape;
+				std::unique_ptr<btPairCachingGhostObject> mGhostObject;
+			};
+
+			///
+			/// 合并的静态碰撞体
+			/// 把很多静态盒子（关卡的墙）合并成一个带动态AABB树的btCompoundShape，broadphase里只有一个物体，
+			/// 碰撞对的数量不再随墙的数量增加。
+			/// 
+			/// 传送门需要关闭物体与它附着的那面墙之间的碰撞，所以被射线击中的盒子可以被拆出来，
+			/// 变成一个独立的Box（见Detach()），其他盒子仍然在合并的形状里。
+			/// 使用Physics::CreateStaticCompound来创建实例
+			/// 
+			class StaticCompound : public PhysicsObject
+			{
+			public:
+				///
+				/// 组成合并碰撞体的一个盒子
+				/// 
+				struct Part
+				{
+					glm::vec3 position;
+					glm::vec3 size;
+				};
+
+				///
+				/// 构造函数
+				/// 
+				/// @param parts
+				///		所有的盒子
+				/// 
+				/// @param physics
+				///		Reference to Physics，拆出来的盒子由它创建
+				/// 
+				/// @param group
+				///		物体的分组
+				/// 
+				/// @param mask
+				///		物体的掩码，用于过滤碰撞
+				/// 
+				StaticCompound( std::vector<Part> parts,
+								Physics& physics,
+								int group,
+								int mask );
+				~StaticCompound();
+
+				///
+				/// 把一个盒子从合并的形状里拆出来，变成独立的碰撞体
+				/// 拆出来的盒子不会再放回去，之后射线会直接击中它
+				/// 
+				/// @param child_index
+				///		盒子在btCompoundShape里的序号，射线检测结果里的m_localShapeInfo->m_triangleIndex
+				/// 
+				/// @return
+				///		独立的碰撞体
+				/// 
+				const btCollisionObject* Detach( int child_index );
+
+				///
+				/// 合并形状里还剩多少个盒子
+				/// 
+				int GetNumChildren() const;
+
+				///
+				/// 拆出来的盒子数量
+				/// 
+				int GetNumDetached() const;
+
+			private:
+				std::vector<Part> mParts;
+				std::vector<std::shared_ptr<btBoxShape>> mChildShapes;  //< 按Part的序号
+				std::vector<int> mChildToPart;                          //< btCompoundShape里的序号 -> Part的序号
+				std::vector<std::unique_ptr<Box>> mDetachedParts;       //< 按Part的序号，没拆出来的是nullptr
+			};
+
+			///
+			/// 物理世界的快照，见SaveSnapshot()/RestoreSnapshot()
+			/// 每个动态和运动学物体的状态是一个定长的POD，连续存在一个数组里
 			/// 
-			Physics( Renderer& renderer );
+			class Snapshot
+			{
+			public:
+				size_t GetNumObjects() const;
+
+				///
+				/// 状态数据占用的字节数
+				/// 
+				size_t GetSizeBytes() const;
+
+			private:
+				friend class Physics;
+
+				struct ObjectState
+				{
+					btTransformFloatData transform;
+					btTransformFloatData previous_transform; //< MotionState里上一步的变换，插值和连续碰撞检测用
+					btVector3FloatData linear_velocity;
+					btVector3FloatData angular_velocity;
+					float deactivation_time;
+					int activation_state;
+					int is_simulated;
+				};
+
+				std::vector<PhysicsObject*> mObjects; //< 和mStates一一对应
+				std::vector<ObjectState> mStates;
+				uint64_t mRemovedObjects = 0;         //< 保存时Physics::mRemovedObjects的值
+				float mAccumulator = 0.f;
+			};
+
+		public:
+			Physics();
 			~Physics();
 
 			///
@@ -294,16 +637,124 @@ namespace portal
 			/// @param dt
 			///		物理更新的固定间隔 单位：秒
 			/// 
-			void Initialize( float dt );
+			/// @param settings
+			///		物理世界的配置
+			/// 
+			void Initialize( float dt, const Settings& settings = Settings{} );
+
+			///
+			/// 物理模拟实际使用的线程数
+			/// 
+			int GetNumThreads() const;
 
 			///
-			/// 更新物理信息，调用频率越高结果越准确
+			/// 设置世界边界，通常是关卡所有墙的范围再加一点余量
+			/// AXIS_SWEEP会按新的边界重建broadphase，已经在世界里的物体会被重新加入；DBVT没有边界，只记录下来
+			/// 超出边界的物体仍然能模拟，但它们在sweep and prune里会挤在边界上，效率变差
+			/// 
+			void SetWorldBounds( const AABB& bounds );
+
+			Broadphase GetBroadphase() const;
+
+			///
+			/// 更新物理信息，按距离上次Update()的真实时间推进，见Step()
 			/// 
 			/// @param enable_debug_draw
 			///		是否渲染物理debug数据
 			/// 
 			void Update();
 
+			///
+			/// 用给定的时间推进物理，不读取系统时钟
+			/// 时间先累加起来，再按Initialize()给的固定间隔一步一步模拟，剩下不足一步的留到下次
+			/// 
+			/// 为了防止卡顿后越追越慢，单次推进的时间超过MAX_FRAME_TIME会被截断，
+			/// 一次最多模拟MAX_STEPS_PER_UPDATE步，追不上的步数直接丢弃
+			/// 
+			/// 基准测试和回放每次推进一个固定间隔，正好模拟一步
+			/// 
+			/// @param elapsed_seconds
+			///		推进的时间 单位：秒
+			/// 
+			void Step( float elapsed_seconds );
+
+			///
+			/// 上一次Update()/Step()中物理模拟的耗时 单位：毫秒
+			/// 
+			float GetLastStepMs() const;
+
+			///
+			/// 上一次Update()/Step()中broadphase更新重叠对的耗时 单位：毫秒
+			/// 包括更新AABB（sweep and prune在这里增量维护重叠对）和calculateOverlappingPairs()
+			/// 只在Settings::measure_broadphase打开时有效，否则总是0
+			/// 
+			float GetLastBroadphaseMs() const;
+
+			///
+			/// 上一次Update()/Step()中Bullet各阶段的耗时 单位：毫秒
+			/// 来自Bullet自己的BT_PROFILE区间，多步时累加；只在Settings::profile_bullet打开时有效，否则都是0
+			/// 多线程时只统计调用Step()的线程，并行部分算在发起它的阶段里
+			/// 
+			struct StepProfile
+			{
+				float broadphase_ms = 0.f;  //< updateAabbs + calculateOverlappingPairs
+				float narrowphase_ms = 0.f; //< dispatchAllCollisionPairs + createPredictiveContacts
+				float solver_ms = 0.f;      //< solveConstraints
+				float integration_ms = 0.f; //< predictUnconstraintMotion + integrateTransforms
+			};
+			const StepProfile& GetLastStepProfile() const;
+
+			///
+			/// 还没模拟的时间占一步的比例 [0.0 - 1.0]
+			/// 渲染时用来在上一步和当前步的状态之间插值
+			/// 用Update()推进时还包括距离上次Update()的真实时间，这样渲染频率高于更新频率时画面也是连续的
+			/// 直接用Step()推进时（固定步长模式）还没模拟的时间总是0，只有开了SetRealTimeInterpolation()才会插值
+			/// 
+			float GetInterpolationAlpha() const;
+
+			///
+			/// 直接用Step()推进时，渲染插值也加上距离上次Step()的真实时间
+			/// 只在Step()由真实的计时器按固定间隔调用时打开，比如录制时的--uncapped-render。
+			/// 基准测试和回放每次更新完马上渲染，保持关闭，画面才能重复
+			/// 
+			void SetRealTimeInterpolation( bool enabled );
+
+			///
+			/// 固定步长的统计
+			/// 
+			struct StepStats
+			{
+				uint64_t steps = 0;          //< 模拟的总步数
+				uint64_t dropped_steps = 0;  //< 超出追赶上限被丢弃的步数
+				uint64_t clamped_frames = 0; //< 推进时间过长被截断的次数
+			};
+			const StepStats& GetStepStats() const;
+
+			///
+			/// 保存所有动态和运动学物体的变换、速度、激活状态和是否在物理世界里，以及还没模拟的时间
+			/// 静态物体（墙）不会变，不保存
+			/// 
+			/// @param snapshot
+			///		保存到这里，可以反复使用同一个快照，不会重新申请内存
+			/// 
+			void SaveSnapshot( Snapshot& snapshot ) const;
+
+			///
+			/// 恢复快照，之后的模拟和从保存时继续模拟一样
+			/// 保存之后才创建的物体不受影响；保存之后有物体被销毁时快照失效
+			/// 被恢复的物体的接触缓存会被清掉，下一步重新检测
+			/// 
+			/// @return
+			///		快照已经失效时返回false，什么都不改变
+			/// 
+			bool RestoreSnapshot( const Snapshot& snapshot );
+
+			///
+			/// 快照是否还能恢复（保存之后没有物体被销毁）
+			/// 快照之外还要恢复其他状态时，先用它检查，避免只恢复了一半
+			/// 
+			bool IsSnapshotValid( const Snapshot& snapshot ) const;
+
 			///
 			/// 创建盒子
 			/// 
@@ -333,28 +784,178 @@ namespace portal
 				bool is_ghost = false, 
 				physics::Callback callback = {} );
 
+			///
+			/// 创建触发区
+			/// 
+			/// 参数请见Trigger构造函数
+			/// 
+			std::unique_ptr<Trigger> CreateTrigger(
+				glm::vec3 pos,
+				glm::vec3 size,
+				int group,
+				int mask );
+
+			///
+			/// 创建合并的静态碰撞体
+			/// 
+			/// 参数请见StaticCompound构造函数
+			/// 
+			std::unique_ptr<StaticCompound> CreateStaticCompound(
+				std::vector<StaticCompound::Part> parts,
+				int group,
+				int mask );
+
 			///
 			/// 发射射线
+			/// 只查询，不改变物理世界。回调的最后一个参数是击中的子形状序号，没有击中复合形状时是-1
 			/// 
-			void CastRay( glm::vec3 from, glm::vec3 to, int filter_group, std::function<void(bool, glm::vec3, glm::vec3, const btCollisionObject* )> callback = nullptr );
+			void CastRay( glm::vec3 from, glm::vec3 to, int filter_group, std::function<void(bool, glm::vec3, glm::vec3, const btCollisionObject*, int )> callback = nullptr );
 
 			///
-			/// 渲染物理Debug信息
+			/// 获取射线击中的表面对应的独立碰撞体，用于附着传送门
+			/// 击中StaticCompound时，被击中的盒子会被拆出来（见StaticCompound::Detach()），其他情况原样返回
+			/// 
+			/// @param hit_object
+			///		CastRay()回调收到的碰撞体
+			/// 
+			/// @param child_index
+			///		CastRay()回调收到的子形状序号
+			/// 
+			const btCollisionObject* ResolveAttachSurface( const btCollisionObject* hit_object, int child_index );
+
+			///
+			/// 唤醒区域里所有的动态物体
+			/// 睡眠的物体不会因为附近的静态物体改变（比如放置传送门）而醒来，需要手动唤醒
+			/// 
+			void ActivateInRegion( const AABB& region );
+
+			///
+			/// 设置物理Debug信息的输出，默认没有，DebugRender()什么都不做
+			/// 物理世界不依赖渲染器，无头模式下不需要设置
+			/// 
+			/// @param debug_drawer
+			///		由调用者持有，必须比Physics活得久或者在销毁前设回nullptr
+			/// 
+			void SetDebugDrawer( btIDebugDraw* debug_drawer );
+
+			///
+			/// 把物理Debug信息画到SetDebugDrawer()给的输出上
 			/// 
 			void DebugRender();
 
+			///
+			/// 获取碰撞形状，尺寸相同的物体共用同一个形状
+			/// 缓存只保存弱引用，所有使用者都销毁后形状也会被释放
+			/// 
+			/// @param size
+			///		长宽高
+			/// 
+			std::shared_ptr<btBoxShape> GetBoxShape( glm::vec3 size );
+
+			///
+			/// @param raidus
+			///		胶囊两头球形的半径
+			/// 
+			/// @param height
+			///		胶囊身体的长度
+			/// 
+			std::shared_ptr<btCapsuleShape> GetCapsuleShape( float raidus, float height );
+
+			///
+			/// 缓存里仍在使用的形状数量
+			/// 
+			size_t GetCachedShapeCount() const;
+
 		private:
+			using ShapeKey = std::tuple<int, float, float, float>; //< 形状类型 + 尺寸
+
+			template<typename Shape, typename... Args>
+			std::shared_ptr<Shape> GetCachedShape( const ShapeKey& key, Args&&... args );
+
+			template<typename Shape>
+			ObjectPool<Shape>& GetShapePool();
+
+			///
+			/// 有回调的物体登记后才会收到接触事件
+			/// 
+			void RegisterContactListener( PhysicsObject& object );
+			void UnregisterContactListener( PhysicsObject& object );
+
+			///
+			/// 物体被销毁或移出物理世界时调用，不管它有没有登记回调
+			/// 把上一步和它有关的接触对删掉，并马上分发END事件，这时它的地址还有效。
+			/// 否则地址被新物体复用时，下一步会把新物体的BEGIN当成STAY
+			/// 
+			/// @param notify_self
+			///		是否也通知物体自己，析构时物体已经不完整了，只通知另一方
+			/// 
+			void RemoveContactPairs( PhysicsObject& object, bool notify_self );
+
+			///
+			/// 每一步模拟之后调用一次
+			/// 遍历dispatcher里所有的持久接触流形，和上一步的接触对比较，
+			/// 把BEGIN/STAY/END事件收集起来再统一分发
+			/// 
+			void DispatchContactEvents();
+
+			///
+			/// 按mBroadphaseType和世界边界创建broadphase，需要时包上计时
+			/// 
+			std::unique_ptr<btBroadphaseInterface> CreateBroadphase( const AABB& bounds );
+
+			using ContactPair = std::pair<const btCollisionObject*, const btCollisionObject*>; //< 按地址排序，first < second
+
+			struct PendingContactEvent
+			{
+				ContactEvent event;
+				const btCollisionObject* object;
+				const btCollisionObject* other;
+			};
+
 			// Bullet3 物理所需组件
+			std::unique_ptr<btITaskScheduler> mTaskScheduler; //< 多线程时使用，必须比下面的组件活得久
 			std::unique_ptr<btDefaultCollisionConfiguration> mConfiguration;
 			std::unique_ptr<btCollisionDispatcher> mCollisionDispatcher;
+			std::unique_ptr<btGhostPairCallback> mGhostPairCallback; //< 维护Trigger的重叠列表，必须比broadphase活得久
 			std::unique_ptr<btBroadphaseInterface> mBroadphaseInterface;
-			std::unique_ptr<btSequentialImpulseConstraintSolver> mSequentialImpulseConstraintSolver;
+			std::unique_ptr<btConstraintSolver> mConstraintSolver;
+			std::unique_ptr<btConstraintSolverPoolMt> mConstraintSolverPool;
 			std::unique_ptr<btDiscreteDynamicsWorld> mWorld;
 
 			std::chrono::steady_clock::time_point mPreviousUpdateTimepoint; //< 上一次Update被调用的时间点
-
-			std::unique_ptr<DebugRenderer> mDebugRenderer;
-			Renderer& mRenderer;
+			std::chrono::steady_clock::time_point mLastStepTimepoint;       //< 上一次Step()开始的时间点，见SetRealTimeInterpolation()
+			float mLastStepMs;                                              //< 上一次物理模拟的耗时
+			float mLastBroadphaseMs;                                        //< 上一次物理模拟中broadphase的耗时
+			Broadphase mBroadphaseType;
+			bool mIsMeasuringBroadphase;
+			StepProfile mLastStepProfile;                                   //< 上一次物理模拟中Bullet各阶段的耗时
+			bool mIsProfilingBullet;
+			AABB mWorldBounds;
+			float mFixedTimeStep;                                           //< 固定步长 单位：秒
+			float mAccumulator;                                             //< 还没模拟的时间 单位：秒
+			bool mIsRealTime;                                               //< 是否由Update()按真实时间推进
+			bool mIsInterpolatingRealTime;                                  //< 见SetRealTimeInterpolation()
+			StepStats mStepStats;
+
+			// 刚体、运动状态和形状都从内存池分配，大量生成和销毁物体时不走通用的堆
+			// 所有物体都必须在Physics之前销毁
+			ObjectPool<btRigidBody> mRigidBodyPool;
+			ObjectPool<MotionState> mMotionStatePool;
+			ObjectPool<btBoxShape> mBoxShapePool;
+			ObjectPool<btCapsuleShape> mCapsuleShapePool;
+
+			std::map<ShapeKey, std::weak_ptr<btCollisionShape>> mShapeCache;
+			std::unordered_map<const btCollisionObject*, StaticCompound*> mStaticCompounds;
+
+			std::unordered_map<const btCollisionObject*, PhysicsObject*> mContactListeners;
+			std::vector<ContactPair> mContactPairs;                 //< 上一步的接触对，排好序的
+			std::vector<ContactPair> mCurrentContactPairs;          //< 这一步的接触对，只是为了复用内存
+			std::vector<PendingContactEvent> mPendingContactEvents; //< 同上
+
+			btIDebugDraw* mDebugDrawer;
+
+			std::vector<PhysicsObject*> mMovingObjects; //< 所有动态和运动学物体，快照用
+			uint64_t mRemovedObjects;                   //< 从mMovingObjects里移除过的物体数
 		};
 	}
 }
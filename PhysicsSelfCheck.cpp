@@ -0,0 +1,94 @@
+#include "PhysicsSelfCheck.h"
+
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include "LevelConstants.h"
+#include "Physics.h"
+
+using namespace portal;
+using namespace portal::physics;
+using namespace portal::level;
+
+namespace
+{
+	constexpr float STEP_TIME = 1.f / 60.f;
+	constexpr int MAX_SETTLE_STEPS = 60;
+	const glm::vec3 BOX_POSITION{ 0.f, 1.f, 0.f };
+	const glm::vec3 BOX_SIZE{ 2.f };
+
+	const char*
+	get_event_name( ContactEvent event )
+	{
+		switch( event )
+		{
+		case ContactEvent::BEGIN:
+			return "BEGIN";
+		case ContactEvent::STAY:
+			return "STAY";
+		case ContactEvent::END:
+		default:
+			return "END";
+		}
+	}
+}
+
+bool
+portal::physics::CheckContactEventsOnRecreate()
+{
+	using ContactRecord = std::pair<ContactEvent, const btCollisionObject*>;
+	std::vector<ContactRecord> floor_events;
+
+	Physics physics;
+	physics.Initialize( STEP_TIME );
+
+	const int box_group = static_cast<int>( PhysicsGroup::BOX );
+	const int wall_group = static_cast<int>( PhysicsGroup::WALL );
+	auto floor = physics.CreateBox(
+		{ 0.f, -5.f, 0.f }, { 100.f, 10.f, 100.f },
+		Physics::PhysicsObject::Type::STATIC, wall_group, box_group, false,
+		Callback{ [&floor_events]( ContactEvent event, const btCollisionObject* other ) { floor_events.emplace_back( event, other ); } } );
+
+	// 等盒子落到地板上，第一次接触必须是BEGIN
+	auto box = physics.CreateBox( BOX_POSITION, BOX_SIZE, Physics::PhysicsObject::Type::DYNAMIC, box_group, wall_group );
+	const btCollisionObject* old_box = box->GetCollisionObject();
+	for( int i = 0; i < MAX_SETTLE_STEPS && floor_events.empty(); i++ )
+	{
+		physics.Step( STEP_TIME );
+	}
+	if( floor_events.empty() || floor_events.front() != ContactRecord{ ContactEvent::BEGIN, old_box } )
+	{
+		std::cerr << "ERROR: Self check: the floor never got BEGIN for the first box" << std::endl;
+		return false;
+	}
+
+	// 销毁时地板马上收到END，这时旧的地址还有效
+	floor_events.clear();
+	box.reset();
+	if( floor_events.size() != 1 || floor_events.front() != ContactRecord{ ContactEvent::END, old_box } )
+	{
+		std::cerr << "ERROR: Self check: destroying a box did not send exactly one END to the floor" << std::endl;
+		return false;
+	}
+
+	// 新盒子（很可能是同一个地址）的第一个事件必须是BEGIN
+	floor_events.clear();
+	box = physics.CreateBox( BOX_POSITION, BOX_SIZE, Physics::PhysicsObject::Type::DYNAMIC, box_group, wall_group );
+	const btCollisionObject* new_box = box->GetCollisionObject();
+	for( int i = 0; i < MAX_SETTLE_STEPS && floor_events.empty(); i++ )
+	{
+		physics.Step( STEP_TIME );
+	}
+	if( floor_events.empty() || floor_events.front() != ContactRecord{ ContactEvent::BEGIN, new_box } )
+	{
+		std::cerr << "ERROR: Self check: the recreated box started with "
+				  << ( floor_events.empty() ? "no event" : get_event_name( floor_events.front().first ) )
+				  << " instead of BEGIN" << std::endl;
+		return false;
+	}
+
+	std::cout << "Self check: contact events on recreate passed"
+			  << ( new_box == old_box ? " (address reused)" : "" ) << std::endl;
+	return true;
+}
@@ -0,0 +1,20 @@
+#ifndef _PHYSICS_SELF_CHECK_H
+#define _PHYSICS_SELF_CHECK_H
+
+namespace portal
+{
+	namespace physics
+	{
+		///
+		/// 接触事件的自检：盒子躺在有回调的地板上，销毁后马上在同一个位置创建新的盒子
+		/// 对象池会优先复用刚释放的地址，地板必须先收到旧盒子的END，再收到新盒子的BEGIN，不能是STAY
+		/// 不需要OpenGL context，见--self-check
+		///
+		/// @return
+		///		True表示通过，失败时在std::cerr输出原因
+		///
+		bool CheckContactEventsOnRecreate();
+	}
+}
+
+#endif
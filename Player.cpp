@@ -59,8 +59,7 @@ Player::Spawn( glm::vec3 position, std::shared_ptr<Camera> camera )
 	mCollisionCapsule->SetAngularFactor( { 0.f, 0.f, 0.f } );
 	mCollisionCapsule->SetDamping( PLAYER_AIR_DAMPING, 0.f );
 
-	mCollisionCapsule->GetCollisionObject()->setUserPointer( static_cast<void*>( this ) );
-	mPortalablePO = mCollisionCapsule.get();
+	SetPortalableObject( mCollisionCapsule.get() );
 }
 
 void
@@ -150,11 +149,11 @@ Player::HandleMouse( std::unordered_map<int, bool>& button_map, Portal& portal_l
 			mPhysics.CastRay( 
 				mMainCamera->GetPosition(), look_dir, 
 				static_cast<int>( PhysicsGroup::RAY ),
-				[&, this]( bool is_hit, glm::vec3 hit_point, glm::vec3 hit_normal, const btCollisionObject* obj )
+				[&, this]( bool is_hit, glm::vec3 hit_point, glm::vec3 hit_normal, const btCollisionObject* obj, int child_index )
 				{
-					if( is_hit )
+					if( is_hit && portal_left.PlaceAt( hit_point, hit_normal, obj ) )
 					{
-						portal_left.PlaceAt( hit_point, hit_normal, obj );
+						portal_left.SetAttachedCollisionObject( mPhysics.ResolveAttachSurface( obj, child_index ) );
 					}
 				}
 			);
@@ -171,11 +170,11 @@ Player::HandleMouse( std::unordered_map<int, bool>& button_map, Portal& portal_l
 			mPhysics.CastRay( 
 				mMainCamera->GetPosition(), look_dir, 
 				static_cast<int>( PhysicsGroup::RAY ),
-				[&, this]( bool is_hit, glm::vec3 hit_point, glm::vec3 hit_normal, const btCollisionObject* obj )
+				[&, this]( bool is_hit, glm::vec3 hit_point, glm::vec3 hit_normal, const btCollisionObject* obj, int child_index )
 				{
-					if( is_hit )
+					if( is_hit && portal_right.PlaceAt( hit_point, hit_normal, obj ) )
 					{
-						portal_right.PlaceAt( hit_point, hit_normal, obj );
+						portal_right.SetAttachedCollisionObject( mPhysics.ResolveAttachSurface( obj, child_index ) );
 					}
 				}
 			);
@@ -225,3 +224,11 @@ Player::GetLookDirection()
 {
 	return mMainCamera->GetLookDirection();
 }
+
+glm::vec3
+Player::GetInterpolatedCameraPosition( float alpha ) const
+{
+	glm::vec3 pos = mCollisionCapsule->GetInterpolatedPosition( alpha );
+	pos.y += PLAYER_CAMERA_OFFSET;
+	return pos;
+}
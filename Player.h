@@ -82,6 +82,14 @@ namespace portal
 
 		glm::vec3 GetPosition();
 		glm::vec3 GetLookDirection();
+
+		///
+		/// 渲染用的摄像机位置，在上一步和当前步的物理结果之间插值
+		/// 
+		/// @param alpha
+		///		Physics::GetInterpolationAlpha()
+		/// 
+		glm::vec3 GetInterpolatedCameraPosition( float alpha ) const;
 		
 	private:
 		physics::Physics& mPhysics;
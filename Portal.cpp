@@ -1,4 +1,5 @@
 ﻿#include "Portal.h"
+#include <algorithm>
 #include <iostream>
 
 #define _USE_MATH_DEFINES
@@ -67,6 +68,9 @@ namespace
 	const float PORTAL_FRAME_TICKNESS = 4.f;
 	const float PORTAL_ENTRY_TRIGGER_DEPTH = 1.f;
 	const float PORTAL_ENTRY_TRIGGER_OFFSET = PORTAL_ENTRY_TRIGGER_DEPTH / 2;
+
+	// 从门面的本地空间穿过去要绕上方向转180度，它的逆就是它自己
+	const glm::mat4 PORTAL_HALF_TURN = glm::rotate( glm::mat4( 1.f ), glm::radians( 180.f ), glm::vec3( 0.f, 1.f, 0.f ) );
 }
 
 Portal::Portal( TextureInfo* texture, physics::Physics& physics )
@@ -78,35 +82,47 @@ Portal::Portal( TextureInfo* texture, physics::Physics& physics )
 	, mFrameRenderable( generate_portal_frame(), Renderer::PORTAL_FRAME_SHADER, texture )
 	, mHoleRenderable( generate_portal_ellipse_hole( PORTAL_GUT_WIDTH, PORTAL_GUT_HEIGHT ), Renderer::PORTAL_HOLE_SHADER, nullptr, Renderer::Renderable::DrawType::TRIANGLE_FANS )
 	, mHasBeenPlaced( false )
+	, mHoleInverseTransform( glm::inverse( mHoleRenderable.GetTransform() ) )
+	, mToPairTransform( 1.f )
+	, mFromPairTransform( 1.f )
 	, mPairedPortal( nullptr )
 	, mAttchedCO( nullptr )
 	, mPhysics( physics )
+{
+	// 碰撞体在第一次PlaceAt()时才创建，没放置的传送门不占用broadphase
+}
+
+Portal::~Portal()
+{}
+
+void
+Portal::CreatePhysicsObjects()
 {
 	// 创建门框碰撞体
 	const glm::vec3 front_offset = mFaceDir * PORTAL_FRAME_TICKNESS / 2.f;
 	mFrameBoxes.emplace_back(
-		physics.CreateBox( 
+		mPhysics.CreateBox( 
 			mPosition + mUpDir * PORTAL_FRAME_UP_OFFSET - front_offset,
 			{ 4 * PORTAL_GUT_WIDTH, PORTAL_GUT_HEIGHT / 2.f, PORTAL_FRAME_TICKNESS }, 
 			Physics::PhysicsObject::Type::STATIC, 
 			static_cast<int>( PhysicsGroup::PORTAL_FRAME ),
 			static_cast<int>( PhysicsGroup::PLAYER ) ) );
 	mFrameBoxes.emplace_back(
-		physics.CreateBox( 
+		mPhysics.CreateBox( 
 			mPosition +  mUpDir * -PORTAL_FRAME_UP_OFFSET - front_offset,
 			{ 4 * PORTAL_GUT_WIDTH, PORTAL_GUT_HEIGHT / 2.f, PORTAL_FRAME_TICKNESS }, 
 			Physics::PhysicsObject::Type::STATIC, 
 			static_cast<int>( PhysicsGroup::PORTAL_FRAME ),
 			static_cast<int>( PhysicsGroup::PLAYER ) ) );
 	mFrameBoxes.emplace_back(
-		physics.CreateBox( 
+		mPhysics.CreateBox( 
 			mPosition + mRightDir * -PORTAL_FRAME_RIGHT_OFFSET - front_offset,
 			{ PORTAL_GUT_WIDTH, 2 * PORTAL_GUT_HEIGHT, PORTAL_FRAME_TICKNESS }, 
 			Physics::PhysicsObject::Type::STATIC, 
 			static_cast<int>( PhysicsGroup::PORTAL_FRAME ),
 			static_cast<int>( PhysicsGroup::PLAYER ) ) );
 	mFrameBoxes.emplace_back(
-		physics.CreateBox( 
+		mPhysics.CreateBox( 
 			mPosition + mRightDir * PORTAL_FRAME_RIGHT_OFFSET - front_offset,
 			{ PORTAL_GUT_WIDTH, 2 * PORTAL_GUT_HEIGHT, PORTAL_FRAME_TICKNESS }, 
 			Physics::PhysicsObject::Type::STATIC, 
@@ -114,32 +130,72 @@ Portal::Portal( TextureInfo* texture, physics::Physics& physics )
 			static_cast<int>( PhysicsGroup::PLAYER ) ) );
 
 	// 创建两个触发区
-	const bool is_ghost = true;
-	mEntryTrigger = physics.CreateBox( 
+	mEntryTrigger = mPhysics.CreateTrigger( 
 			mPosition +  mFaceDir * 3.f * PORTAL_ENTRY_TRIGGER_OFFSET,
 			{ 2 * PORTAL_GUT_WIDTH, 2 * PORTAL_GUT_HEIGHT, 8.f * PORTAL_ENTRY_TRIGGER_DEPTH }, 
-			Physics::PhysicsObject::Type::STATIC, 
 			static_cast<int>( PhysicsGroup::PORTAL_FRAME ),
-			static_cast<int>( PhysicsGroup::PLAYER ),
-			is_ghost
+			static_cast<int>( PhysicsGroup::PLAYER )
 		);
-	mTeleportTrigger = physics.CreateBox( 
+	mTeleportTrigger = mPhysics.CreateTrigger( 
 			mPosition - mFaceDir * PORTAL_ENTRY_TRIGGER_OFFSET,
 			{ 2 * PORTAL_GUT_WIDTH, 2 * PORTAL_GUT_HEIGHT, PORTAL_ENTRY_TRIGGER_DEPTH }, 
-			Physics::PhysicsObject::Type::STATIC, 
 			static_cast<int>( PhysicsGroup::PORTAL_FRAME ),
-			static_cast<int>( PhysicsGroup::PLAYER ),
-			is_ghost
+			static_cast<int>( PhysicsGroup::PLAYER )
 		);
 }
 
-Portal::~Portal()
-{}
+void
+Portal::DestroyPhysicsObjects()
+{
+	mFrameBoxes.clear();
+	mEntryTrigger.reset();
+	mTeleportTrigger.reset();
+}
+
+void
+Portal::ReleasePortalables()
+{
+	if( mAttchedCO )
+	{
+		for( auto portalable : mEnteringPortalables )
+		{
+			portalable->GetPhysicsObject()->SetIgnoireCollisionWith( mAttchedCO, false );
+		}
+	}
+	mEnteringPortalables.clear();
+}
 
 void 
 Portal::SetPair( Portal* paired_portal )
 {
 	mPairedPortal = paired_portal;
+	UpdatePairTransforms();
+}
+
+void
+Portal::SetPlacementCallback( std::function<void()> callback )
+{
+	mPlacementCallback = std::move( callback );
+}
+
+void
+Portal::UpdatePairTransforms()
+{
+	if( !mPairedPortal )
+	{
+		mToPairTransform = glm::mat4( 1.f );
+		mFromPairTransform = glm::mat4( 1.f );
+		return;
+	}
+	// 先转换到本传送门的本地空间，再旋转180度，然后用出口的模型矩阵转换回世界空间
+	// 两个门面的逆矩阵都是放置时算好的，这里只有矩阵乘法
+	mToPairTransform = mPairedPortal->mHoleRenderable.GetTransform() * PORTAL_HALF_TURN * mHoleInverseTransform;
+	mFromPairTransform = mHoleRenderable.GetTransform() * PORTAL_HALF_TURN * mPairedPortal->mHoleInverseTransform;
+	if( mPairedPortal->mPairedPortal == this )
+	{
+		mPairedPortal->mToPairTransform = mFromPairTransform;
+		mPairedPortal->mFromPairTransform = mToPairTransform;
+	}
 }
 
 bool 
@@ -152,6 +208,21 @@ Portal::PlaceAt( glm::vec3 pos, glm::vec3 dir, const btCollisionObject* attched_
 		return false;
 	}
 
+	if( mAttchedCO != attched_surface_co )
+	{
+		// 换了一面墙，之前在门口的物体要恢复和旧墙的碰撞
+		ReleasePortalables();
+	}
+	if( !mEntryTrigger )
+	{
+		CreatePhysicsObjects();
+	}
+	else
+	{
+		// 原来位置上靠着门框睡眠的物体
+		mPhysics.ActivateInRegion( mEntryTrigger->GetAABB() );
+	}
+
 	mAttchedCO = attched_surface_co;
 	// Bullet物理引擎的射线检测碰撞法线有误差 大概是 < 0.00015
 	// 这里小于这个值的都当作0
@@ -190,6 +261,8 @@ Portal::PlaceAt( glm::vec3 pos, glm::vec3 dir, const btCollisionObject* attched_
 	mFrameRenderable.Rotate( theta, rot_axis );
 	mHoleRenderable.Translate( pos + mFaceDir * 0.1f );
 	mHoleRenderable.Rotate( theta, rot_axis );
+	mHoleInverseTransform = glm::inverse( mHoleRenderable.GetTransform() );
+	UpdatePairTransforms();
 
 	mHasBeenPlaced = true;
 	
@@ -234,7 +307,13 @@ Portal::PlaceAt( glm::vec3 pos, glm::vec3 dir, const btCollisionObject* attched_
 		trans = glm::rotate( trans, theta, rot_axis );
 		mTeleportTrigger->SetTransform( std::move( trans ) );
 	}
+	// 门口睡眠的物体（比如地上的箱子）要醒过来才会掉进传送门
+	mPhysics.ActivateInRegion( mEntryTrigger->GetAABB() );
 
+	if( mPlacementCallback )
+	{
+		mPlacementCallback();
+	}
 	return true;
 }
 
@@ -250,6 +329,45 @@ Portal::GetHoleRenderable()
 	return &mHoleRenderable;
 }
 
+void
+Portal::Remove()
+{
+	ReleasePortalables();
+	mNearbyPortalables.clear();
+	if( mEntryTrigger )
+	{
+		mPhysics.ActivateInRegion( mEntryTrigger->GetAABB() );
+	}
+	DestroyPhysicsObjects();
+	mAttchedCO = nullptr;
+	const bool was_placed = mHasBeenPlaced;
+	mHasBeenPlaced = false;
+	if( was_placed && mPlacementCallback )
+	{
+		mPlacementCallback();
+	}
+}
+
+Portal::Placement
+Portal::GetPlacement() const
+{
+	return { mPosition, mFaceDir, mAttchedCO, mHasBeenPlaced };
+}
+
+void
+Portal::RestorePlacement( const Placement& placement )
+{
+	ReleasePortalables();
+	if( placement.is_placed )
+	{
+		PlaceAt( placement.position, placement.face_dir, placement.attached_co );
+	}
+	else if( mHasBeenPlaced )
+	{
+		Remove();
+	}
+}
+
 bool 
 Portal::HasBeenPlaced()
 {
@@ -278,13 +396,54 @@ Portal::GetPosition()
 	return mPosition;
 }
 
+void
+Portal::Update()
+{
+	if( !IsLinkActive() )
+	{
+		// 配对的传送门被移除了，门口的物体也不能再穿墙
+		ReleasePortalables();
+		mNearbyPortalables.clear();
+		return;
+	}
+
+	mCandidates = mEnteringPortalables;
+	const int num_overlapping = mEntryTrigger->GetNumOverlapping();
+	for( int i = 0; i < num_overlapping; i++ )
+	{
+		Portalable* portalable = Portalable::FromCollisionObject( mEntryTrigger->GetOverlapping( i ) );
+		if( portalable && std::find( mCandidates.begin(), mCandidates.end(), portalable ) == mCandidates.end() )
+		{
+			mCandidates.push_back( portalable );
+		}
+	}
+	for( auto portalable : mNearbyPortalables )
+	{
+		auto physics_object = portalable->GetPhysicsObject();
+		if( std::find( mCandidates.begin(), mCandidates.end(), portalable ) == mCandidates.end() &&
+			mTeleportTrigger->IsSegmentIntersecting( physics_object->GetPreviousPosition(), physics_object->GetPosition() ) )
+		{
+			mCandidates.push_back( portalable );
+		}
+	}
+	mNearbyPortalables.clear();
+
+	mEnteringPortalables.clear();
+	for( auto portalable : mCandidates )
+	{
+		CheckPortalable( portalable );
+	}
+}
+
 void 
 Portal::CheckPortalable( Portalable* portalable )
 {
 	if( mHasBeenPlaced && mPairedPortal && mPairedPortal->HasBeenPlaced() && portalable && portalable->GetPhysicsObject() )
 	{
 		auto physics_object = portalable->GetPhysicsObject();
-		const bool is_detected = IsPortalableEntering( portalable );
+		// 很快的物体可能一步就从门口穿过门面，这时它已经不在任何触发区里了，用这一步扫过的线段检测
+		const bool is_crossed = mTeleportTrigger->IsSegmentIntersecting( physics_object->GetPreviousPosition(), physics_object->GetPosition() );
+		const bool is_detected = is_crossed || IsPortalableEntering( portalable );
 		if( mAttchedCO )
 		{
 			// 当物体在传送门判定区内，关闭物体与传送门附着面的碰撞检测，使得物体可以“穿过”传送门
@@ -301,8 +460,11 @@ Portal::CheckPortalable( Portalable* portalable )
 		}
 		if( is_detected )
 		{
-			auto aabb = mTeleportTrigger->GetAABB();
-			if( aabb.IsContain( physics_object->GetPosition() ) )
+			// 传送走了也要记下来，下一次Update()时它已经不在门口，会恢复和墙的碰撞
+			mEnteringPortalables.push_back( portalable );
+			if( is_crossed ||
+				( mTeleportTrigger->IsOverlapping( physics_object->GetCollisionObject() ) &&
+				  mTeleportTrigger->IsContain( physics_object->GetPosition() ) ) )
 			{
 				portalable->Teleport( *this );
 			}
@@ -313,11 +475,13 @@ Portal::CheckPortalable( Portalable* portalable )
 bool 
 Portal::IsPortalableEntering( Portalable* portalable )
 {
-	if( !portalable || !portalable->GetPhysicsObject() )
+	if( !mEntryTrigger || !portalable || !portalable->GetPhysicsObject() )
 	{
 		return false;
 	}
-	return mEntryTrigger->GetAABB().IsContain( portalable->GetPhysicsObject()->GetPosition() );
+	auto physics_object = portalable->GetPhysicsObject();
+	return mEntryTrigger->IsOverlapping( physics_object->GetCollisionObject() ) &&
+		   mEntryTrigger->IsContain( physics_object->GetPosition() );
 }
 
 glm::vec3 
@@ -332,21 +496,55 @@ Portal::GetUpDir()
 	return mUpDir;
 }
 
+void
+Portal::AddNearbyPortalable( Portalable* portalable )
+{
+	mNearbyPortalables.push_back( portalable );
+}
+
+physics::AABB
+Portal::GetTriggerAABB() const
+{
+	physics::AABB aabb = mEntryTrigger->GetAABB();
+	const physics::AABB teleport_aabb = mTeleportTrigger->GetAABB();
+	aabb.min = glm::min( aabb.min, teleport_aabb.min );
+	aabb.max = glm::max( aabb.max, teleport_aabb.max );
+	return aabb;
+}
+
+float
+Portal::GetHoleRadius() const
+{
+	return std::max( PORTAL_GUT_WIDTH, PORTAL_GUT_HEIGHT );
+}
+
 const btCollisionObject*
 Portal::GetAttachedCollisionObject()
 {
 	return mAttchedCO;
 }
 
+void
+Portal::SetAttachedCollisionObject( const btCollisionObject* attached_surface_co )
+{
+	if( mAttchedCO != attached_surface_co )
+	{
+		ReleasePortalables();
+		mAttchedCO = attached_surface_co;
+	}
+}
+
 glm::mat4 
-Portal::ConvertView( const glm::mat4& view_matrix )
+Portal::ConvertView( const glm::mat4& view_matrix ) const
+{
+	// 摄像机穿到出口后面，相当于把世界从出口搬回本传送门，视图矩阵右乘反方向的变换
+	return view_matrix * mFromPairTransform;
+}
+
+const glm::mat4&
+Portal::GetTransformToPair() const
 {
-	// 先将视图矩阵转换到本传送门的本地空间，再旋转180度，然后用出口的逆变换矩阵转换到世界空间
-	glm::mat4 model_view = view_matrix * mHoleRenderable.GetTransform();
-	glm::mat4 final_view = model_view
-						   * glm::rotate( glm::mat4( 1.f ), glm::radians( 180.f ), glm::vec3( 0.f, 1.f, 0.f ) )
-						   * glm::inverse( mPairedPortal->GetHoleRenderable()->GetTransform() );
-	return final_view;
+	return mToPairTransform;
 }
 
 glm::vec3 
@@ -357,11 +555,7 @@ Portal::ConvertPointToOutPortal( glm::vec3 point )
 		return glm::vec3{ 0.f };
 	}
 
-	// 同ConvertView
-	return mPairedPortal->GetHoleRenderable()->GetTransform()
-		* glm::rotate( glm::mat4( 1.f ), glm::radians( 180.f ), glm::vec3( 0.f, 1.f, 0.f ) ) 
-		* glm::inverse( mHoleRenderable.GetTransform() ) 
-		* glm::vec4( std::move( point ), 1.f );
+	return mToPairTransform * glm::vec4( std::move( point ), 1.f );
 }
 
 glm::vec3 
@@ -1,6 +1,8 @@
 ﻿#ifndef _PORTAL_H
 #define _PORTAL_H
 
+#include <functional>
+
 #include "Renderer.h"
 #include "Physics.h"
 
@@ -15,6 +17,17 @@ namespace portal
 	class Portal
 	{
 	public:
+		///
+		/// 传送门的放置状态，保存快照用
+		/// 
+		struct Placement
+		{
+			glm::vec3 position;
+			glm::vec3 face_dir;
+			const btCollisionObject* attached_co; ///< 附着的墙面，恢复时必须还存在
+			bool is_placed;
+		};
+
 		///
 		/// 构造函数
 		/// 
@@ -32,6 +45,11 @@ namespace portal
 		/// 
 		void SetPair( Portal* paired_portal );
 
+		///
+		/// 传送门每次放置（包括移动）或者被移除时调用，见PortalGraph
+		/// 
+		void SetPlacementCallback( std::function<void()> callback );
+
 		///
 		/// 根据提供的位置和方向更新传送门的方位
 		/// 
@@ -46,6 +64,18 @@ namespace portal
 		/// 
 		bool PlaceAt( glm::vec3 pos, glm::vec3 dir, const btCollisionObject* attched_surface_co );
 
+		///
+		/// 移除传送门，门框和触发区的碰撞体也从物理世界里删除
+		/// 
+		void Remove();
+
+		///
+		/// 获取/恢复放置状态
+		/// 恢复时门口记录的物体都会被释放（它们的位置由物理快照恢复），再按保存时的状态PlaceAt()或Remove()
+		/// 
+		Placement GetPlacement() const;
+		void RestorePlacement( const Placement& placement );
+
 		///
 		/// 获取门框和门面的渲染体
 		/// 
@@ -77,12 +107,34 @@ namespace portal
 		glm::vec3 GetPosition();
 
 
+		///
+		/// 处理在门口触发区里的物体，每次物理模拟之后调用
+		/// 只检查broadphase报告和触发区重叠的物体，以及上一次还在门口的物体（离开时要恢复和墙的碰撞）
+		/// 
+		void Update();
+
+		///
+		/// PortalSpatialHash找到的附近物体，下一次Update()时如果它这一步扫过了传送区也会被检查
+		/// （物体太快时可能一步就穿过门口，不在触发区的重叠列表里）
+		/// 
+		void AddNearbyPortalable( Portalable* portalable );
+
+		///
+		/// 门口和传送触发区合起来的包围盒，只在放置后有效
+		/// 
+		physics::AABB GetTriggerAABB() const;
+
 		void CheckPortalable( Portalable* portalable );
 		bool IsPortalableEntering( Portalable* portalable );
 
 		glm::vec3 GetFaceDir();
 		glm::vec3 GetUpDir();
 
+		///
+		/// 门面的外接球半径，视锥剔除用
+		/// 
+		float GetHoleRadius() const;
+
 		///
 		/// 将提供的视图矩阵转换到配对的传送门相对位置的视图矩阵
 		/// 
@@ -92,13 +144,25 @@ namespace portal
 		/// @return
 		///		转换后配对传送门后的视图矩阵
 		/// 
-		glm::mat4 ConvertView( const glm::mat4& view_matrix );
+		glm::mat4 ConvertView( const glm::mat4& view_matrix ) const;
+
+		///
+		/// 从本传送门穿到出口的变换（世界坐标），没有配对的传送门时是单位矩阵
+		/// 在PlaceAt()和SetPair()时算好，传送和克隆每次直接用
+		/// 
+		const glm::mat4& GetTransformToPair() const;
 
 		///
 		/// 获取附着墙面的物理碰撞体
 		/// 
 		const btCollisionObject* GetAttachedCollisionObject();
 
+		///
+		/// 位置不变，把附着的墙面换成另一个碰撞体
+		/// 放到合并的静态墙上以后，用拆出来的盒子替换整个合并体，见Physics::ResolveAttachSurface()
+		/// 
+		void SetAttachedCollisionObject( const btCollisionObject* attached_surface_co );
+
 		///
 		/// 将提供的点转换到出口的相对位置
 		/// 
@@ -122,6 +186,22 @@ namespace portal
 		glm::vec3 ConvertDirectionToOutPortal( glm::vec3 direction, glm::vec3 old_start_pos, glm::vec3 new_start_pos );
 
 	private:
+		///
+		/// 创建/删除门框和触发区的碰撞体
+		/// 
+		void CreatePhysicsObjects();
+		void DestroyPhysicsObjects();
+
+		///
+		/// 恢复门口所有物体和附着墙面的碰撞，并清空记录
+		/// 
+		void ReleasePortalables();
+
+		///
+		/// 更新本传送门和配对传送门之间的变换，任意一边移动或者换了配对时调用
+		/// 
+		void UpdatePairTransforms();
+
 		glm::vec3 mFaceDir;                    ///< 传送门面向的方向
 		glm::vec3 mPosition;                   ///< 传送门位置
 		glm::vec3 mOriginFaceDir;              ///< 传送门初始面向方向
@@ -130,14 +210,22 @@ namespace portal
 		Renderer::Renderable mFrameRenderable; ///< 门框渲染体
 		Renderer::Renderable mHoleRenderable;  ///< 门面渲染体
 		bool mHasBeenPlaced;                   ///< 是否被放置
+		glm::mat4 mHoleInverseTransform;       ///< 门面模型矩阵的逆，PlaceAt()时更新
+		glm::mat4 mToPairTransform;            ///< 见GetTransformToPair()
+		glm::mat4 mFromPairTransform;          ///< mToPairTransform的逆，ConvertView()用
 
 		Portal* mPairedPortal;                 ///< 配对的传送门指针
 		// 当传送门被放置后，如果玩家在传送门的门口区域内，传送门附着的墙壁不能与玩家发生碰撞玩家才能穿过
 		// 传送门。因此我们需要一圈的空气墙作为门框来挡住玩家
+		// 门框和触发区只在传送门被放置后存在
 		std::vector<std::unique_ptr<physics::Physics::Box>> mFrameBoxes;
-		std::unique_ptr<physics::Physics::Box> mEntryTrigger;
-		std::unique_ptr<physics::Physics::Box> mTeleportTrigger;
+		std::unique_ptr<physics::Physics::Trigger> mEntryTrigger;
+		std::unique_ptr<physics::Physics::Trigger> mTeleportTrigger;
+		std::vector<Portalable*> mEnteringPortalables; ///< 上一次Update()时在门口的物体
+		std::vector<Portalable*> mCandidates;          ///< Update()要检查的物体，只是为了复用内存
+		std::vector<Portalable*> mNearbyPortalables;   ///< 见AddNearbyPortalable()，Update()之后清空
 		const btCollisionObject* mAttchedCO;
+		std::function<void()> mPlacementCallback;
 
 		physics::Physics& mPhysics;
 	};
@@ -0,0 +1,248 @@
+#include "PortalBenchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+#include <rapidjson/ostreamwrapper.h>
+#include <rapidjson/prettywriter.h>
+
+#include "Benchmark.h"
+#include "DynamicBox.h"
+#include "LevelConstants.h"
+#include "Portal.h"
+#include "PortalGraph.h"
+#include "PortalSpatialHash.h"
+#include "Profiler.h"
+
+using namespace portal;
+using namespace portal::physics;
+using namespace portal::level;
+
+namespace
+{
+	const float PAIR_SPACING = 30.f;        // 相邻两对传送门之间的距离，比门框宽
+	const float WALL_THICKNESS = 10.f;
+	const float MIN_CHAMBER_HEIGHT = 200.f;
+	const float DROP_HEIGHT = 20.f;          // 最下面的盒子离地板的高度
+	const float BOX_STACK_SPACING = DynamicBox::SIZE + 3.f;
+	const float WORLD_BOUNDS_MARGIN = 100.f;
+	const float PORTAL_HASH_CELL_SIZE = 32.f;
+
+	///
+	/// 记录传送次数和耗时的盒子，传送本身还是DynamicBox::Teleport()
+	///
+	class CountingBox : public DynamicBox
+	{
+	public:
+		CountingBox( Physics& physics, glm::vec3 pos, int& teleports, double& teleport_ms )
+			: DynamicBox( physics, pos )
+			, mTeleports( teleports )
+			, mTeleportMs( teleport_ms )
+		{}
+
+		virtual void Teleport( Portal& in_portal ) override
+		{
+			const auto begin = std::chrono::steady_clock::now();
+			DynamicBox::Teleport( in_portal );
+			mTeleportMs += std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - begin ).count();
+			mTeleports++;
+		}
+
+	private:
+		int& mTeleports;
+		double& mTeleportMs;
+	};
+}
+
+PortalBenchmark::PortalBenchmark( int updates, int update_interval_ms, const physics::Settings& physics_settings )
+	: mUpdates( std::max( updates, 1 ) )
+	, mUpdateInterval( update_interval_ms / 1000.f )
+	, mPhysicsSettings( physics_settings )
+{}
+
+PortalBenchmark::~PortalBenchmark()
+{}
+
+/*static*/
+bool
+PortalBenchmark::ParseCounts( const std::string& text, std::vector<int>& counts )
+{
+	std::stringstream ss{ text };
+	std::string item;
+	while( std::getline( ss, item, ',' ) )
+	{
+		const int count = std::atoi( item.c_str() );
+		if( count <= 0 )
+		{
+			return false;
+		}
+		counts.push_back( count );
+	}
+	return !counts.empty();
+}
+
+void
+PortalBenchmark::AddConfig( int portal_pairs, int objects )
+{
+	mConfigs.push_back( { std::max( portal_pairs, 1 ), std::max( objects, 0 ) } );
+}
+
+void
+PortalBenchmark::Run()
+{
+	mResults.clear();
+	for( auto& config : mConfigs )
+	{
+		PORTAL_PROFILE_SCOPE( "PortalBenchmark::RunConfig" );
+		mResults.push_back( RunConfig( config ) );
+		const Result& result = mResults.back();
+		std::cerr << "Portal benchmark: " << config.portal_pairs << " pairs, " << config.objects << " objects, "
+				  << result.teleports << " teleports in " << result.wall_ms << " ms" << std::endl;
+	}
+}
+
+PortalBenchmark::Result
+PortalBenchmark::RunConfig( const Config& config ) const
+{
+	Result result;
+	result.config = config;
+	result.physics_step_ms.reserve( mUpdates );
+	result.portal_check_ms.reserve( mUpdates );
+	result.teleport_ms.reserve( mUpdates );
+
+	// 传送门对排成正方形网格，每对上面的盒子叠成一列，房间高度要放得下最高的一列
+	const int columns = static_cast<int>( std::ceil( std::sqrt( static_cast<float>( config.portal_pairs ) ) ) );
+	const int rows = ( config.portal_pairs + columns - 1 ) / columns;
+	const int boxes_per_pair = ( config.objects + config.portal_pairs - 1 ) / config.portal_pairs;
+	const float width = columns * PAIR_SPACING;
+	const float depth = rows * PAIR_SPACING;
+	const float height = std::max( MIN_CHAMBER_HEIGHT, 2.f * DROP_HEIGHT + boxes_per_pair * BOX_STACK_SPACING );
+
+	Physics physics;
+	physics.Initialize( mUpdateInterval, mPhysicsSettings );
+	physics.SetWorldBounds( {
+		glm::vec3{ width, height + WALL_THICKNESS, depth } + glm::vec3{ WORLD_BOUNDS_MARGIN },
+		glm::vec3{ 0.f, -WALL_THICKNESS, 0.f } - glm::vec3{ WORLD_BOUNDS_MARGIN }
+	} );
+
+	// 地板的上表面在y = 0，天花板的下表面在y = height
+	const int wall_group = static_cast<int>( PhysicsGroup::WALL );
+	const int wall_mask = static_cast<int>( PhysicsGroup::PLAYER ) | static_cast<int>( PhysicsGroup::RAY );
+	auto floor = physics.CreateBox(
+		{ width / 2.f, -WALL_THICKNESS / 2.f, depth / 2.f },
+		{ width, WALL_THICKNESS, depth },
+		Physics::PhysicsObject::Type::STATIC, wall_group, wall_mask );
+	auto ceiling = physics.CreateBox(
+		{ width / 2.f, height + WALL_THICKNESS / 2.f, depth / 2.f },
+		{ width, WALL_THICKNESS, depth },
+		Physics::PhysicsObject::Type::STATIC, wall_group, wall_mask );
+
+	auto portals = std::make_unique<PortalGraph>();
+	std::vector<glm::vec3> pair_centers;
+	for( int i = 0; i < config.portal_pairs; i++ )
+	{
+		const glm::vec3 center{ ( i % columns + 0.5f ) * PAIR_SPACING, 0.f, ( i / columns + 0.5f ) * PAIR_SPACING };
+		const int pair = portals->AddPair( std::make_unique<Portal>( nullptr, physics ), std::make_unique<Portal>( nullptr, physics ) );
+		portals->GetPortal( 2 * pair )->PlaceAt( center, { 0.f, 1.f, 0.f }, floor->GetCollisionObject() );
+		portals->GetPortal( 2 * pair + 1 )->PlaceAt( center + glm::vec3{ 0.f, height, 0.f }, { 0.f, -1.f, 0.f }, ceiling->GetCollisionObject() );
+		pair_centers.push_back( center );
+	}
+
+	double teleport_ms = 0.0;
+	std::vector<std::unique_ptr<CountingBox>> boxes;
+	boxes.reserve( config.objects );
+	for( int i = 0; i < config.objects; i++ )
+	{
+		const int layer = i / config.portal_pairs;
+		const glm::vec3 pos = pair_centers[ i % config.portal_pairs ] + glm::vec3{ 0.f, DROP_HEIGHT + layer * BOX_STACK_SPACING, 0.f };
+		boxes.push_back( std::make_unique<CountingBox>( physics, pos, result.teleports, teleport_ms ) );
+	}
+
+	// 和关卡里一样，盒子先经过空间哈希找到附近的传送门
+	PortalSpatialHash spatial_hash{ PORTAL_HASH_CELL_SIZE };
+	for( auto& box : boxes )
+	{
+		spatial_hash.AddPortalable( box.get() );
+	}
+	spatial_hash.Rebuild( portals->GetPlacedPortals() );
+
+	const auto run_begin = std::chrono::steady_clock::now();
+	for( int update = 0; update < mUpdates; update++ )
+	{
+		physics.Step( mUpdateInterval );
+		result.physics_step_ms.push_back( physics.GetLastStepMs() );
+
+		const double teleport_ms_before = teleport_ms;
+		const auto check_begin = std::chrono::steady_clock::now();
+		spatial_hash.Update();
+		for( Portal* portal : portals->GetPlacedPortals() )
+		{
+			portal->Update();
+		}
+		const double check_ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - check_begin ).count();
+		result.teleport_ms.push_back( teleport_ms - teleport_ms_before );
+		result.portal_check_ms.push_back( check_ms - result.teleport_ms.back() );
+
+		for( auto& box : boxes )
+		{
+			box->Update();
+		}
+	}
+	result.wall_ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - run_begin ).count();
+
+	// 盒子和传送门要在Physics之前销毁
+	boxes.clear();
+	portals.reset();
+	return result;
+}
+
+void
+PortalBenchmark::WriteReport( std::ostream& os ) const
+{
+	rapidjson::OStreamWrapper osw{ os };
+	rapidjson::PrettyWriter<rapidjson::OStreamWrapper> writer{ osw };
+	writer.StartObject();
+	writer.Key( "updates" ); writer.Int( mUpdates );
+	writer.Key( "update_interval_ms" ); writer.Double( mUpdateInterval * 1000.0 );
+	writer.Key( "physics_threads" ); writer.Int( mPhysicsSettings.num_threads );
+	writer.Key( "broadphase" ); writer.String( GetBroadphaseName( mPhysicsSettings.broadphase ) );
+	writer.Key( "runs" );
+	writer.StartArray();
+	for( auto& result : mResults )
+	{
+		const double simulated_seconds = mUpdates * static_cast<double>( mUpdateInterval );
+		writer.StartObject();
+		writer.Key( "portal_pairs" ); writer.Int( result.config.portal_pairs );
+		writer.Key( "objects" ); writer.Int( result.config.objects );
+		writer.Key( "teleports" ); writer.Int( result.teleports );
+		writer.Key( "wall_ms" ); writer.Double( result.wall_ms );
+		writer.Key( "teleports_per_second" ); writer.Double( result.wall_ms > 0.0 ? result.teleports * 1000.0 / result.wall_ms : 0.0 );
+		writer.Key( "teleports_per_simulated_second" ); writer.Double( simulated_seconds > 0.0 ? result.teleports / simulated_seconds : 0.0 );
+		Benchmark::WriteStats( writer, "physics_step_ms", Benchmark::ComputeStats( result.physics_step_ms ) );
+		Benchmark::WriteStats( writer, "portal_check_ms", Benchmark::ComputeStats( result.portal_check_ms ) );
+		Benchmark::WriteStats( writer, "teleport_ms", Benchmark::ComputeStats( result.teleport_ms ) );
+		writer.EndObject();
+	}
+	writer.EndArray();
+	writer.EndObject();
+	os << std::endl;
+}
+
+bool
+PortalBenchmark::SaveReport( const std::string& path ) const
+{
+	std::ofstream ofs{ path };
+	if( !ofs.is_open() )
+	{
+		std::cerr << "ERROR: Failed to open portal benchmark report " << path << std::endl;
+		return false;
+	}
+	WriteReport( ofs );
+	return true;
+}
@@ -0,0 +1,95 @@
+#ifndef _PORTAL_BENCHMARK_H
+#define _PORTAL_BENCHMARK_H
+
+#include <vector>
+#include <string>
+#include <ostream>
+
+#include "Physics.h"
+
+namespace portal
+{
+	///
+	/// 传送门穿越的压力测试
+	/// 在一个封闭的房间里放N对传送门，每对是地板上朝上的门和正上方天花板上朝下的门。
+	/// 每对传送门上方堆着几个盒子，掉进地板的门后从天花板的门出来继续往下掉，一直循环穿越。
+	///
+	/// 用的是真正的Portal和DynamicBox，不需要OpenGL context，物理每次更新固定推进一步。
+	/// 每组（N, M）单独建一个物理世界，结束后输出传送次数、传送门检测、传送和物理模拟的耗时（JSON）
+	///
+	class PortalBenchmark
+	{
+	public:
+		///
+		/// 构造函数
+		///
+		/// @param updates
+		///		每组配置运行的更新次数
+		///
+		/// @param update_interval_ms
+		///		每次更新物理推进的时间
+		///
+		/// @param physics_settings
+		///		物理世界的配置，每组配置都一样
+		///
+		PortalBenchmark( int updates, int update_interval_ms, const physics::Settings& physics_settings );
+		~PortalBenchmark();
+
+		///
+		/// 解析逗号分隔的数量列表，比如"1,4,16"
+		///
+		/// @return
+		///		有不是正整数的项时返回false
+		///
+		static bool ParseCounts( const std::string& text, std::vector<int>& counts );
+
+		///
+		/// 添加要测试的配置
+		///
+		/// @param portal_pairs
+		///		传送门对数N
+		///
+		/// @param objects
+		///		盒子数量M
+		///
+		void AddConfig( int portal_pairs, int objects );
+
+		///
+		/// 按添加的顺序运行所有配置
+		///
+		void Run();
+
+		///
+		/// 输出统计结果
+		///
+		void WriteReport( std::ostream& os ) const;
+		bool SaveReport( const std::string& path ) const;
+
+	private:
+		struct Config
+		{
+			int portal_pairs;
+			int objects;
+		};
+
+		struct Result
+		{
+			Config config;
+			int teleports = 0;
+			double wall_ms = 0.0;                ///< 整组配置运行的真实时间
+			std::vector<double> physics_step_ms; ///< 每次更新的物理模拟耗时
+			std::vector<double> portal_check_ms; ///< 每次更新PortalSpatialHash::Update()和所有传送门Update()/CheckPortalable()的耗时，不含传送
+			std::vector<double> teleport_ms;     ///< 每次更新所有Teleport()的耗时
+		};
+
+		Result RunConfig( const Config& config ) const;
+
+		int mUpdates;
+		float mUpdateInterval;
+		physics::Settings mPhysicsSettings;
+		std::vector<Config> mConfigs;
+		std::vector<Result> mResults;
+	};
+}
+
+#endif
@@ -0,0 +1,101 @@
+#include "PortalGraph.h"
+
+#include "Portal.h"
+
+using namespace portal;
+
+PortalGraph::PortalGraph()
+	: mIsDirty( false )
+	, mPlacementVersion( 0 )
+{}
+
+PortalGraph::~PortalGraph()
+{}
+
+int
+PortalGraph::AddPair( std::unique_ptr<Portal> portal_a, std::unique_ptr<Portal> portal_b )
+{
+	portal_a->SetPair( portal_b.get() );
+	portal_b->SetPair( portal_a.get() );
+	for( Portal* portal : { portal_a.get(), portal_b.get() } )
+	{
+		portal->SetPlacementCallback( [this]()
+		{
+			mIsDirty = true;
+			mPlacementVersion++;
+		} );
+	}
+	mPortals.push_back( std::move( portal_a ) );
+	mPortals.push_back( std::move( portal_b ) );
+	mIsDirty = true;
+	mPlacementVersion++;
+	return GetNumPairs() - 1;
+}
+
+int
+PortalGraph::GetNumPortals() const
+{
+	return static_cast<int>( mPortals.size() );
+}
+
+int
+PortalGraph::GetNumPairs() const
+{
+	return static_cast<int>( mPortals.size() / 2 );
+}
+
+Portal*
+PortalGraph::GetPortal( int index ) const
+{
+	if( index < 0 || index >= GetNumPortals() )
+	{
+		return nullptr;
+	}
+	return mPortals[ index ].get();
+}
+
+const std::vector<Portal*>&
+PortalGraph::GetPlacedPortals()
+{
+	if( mIsDirty )
+	{
+		Rebuild();
+	}
+	return mPlacedPortals;
+}
+
+const std::vector<Portal*>&
+PortalGraph::GetLinkedPortals()
+{
+	if( mIsDirty )
+	{
+		Rebuild();
+	}
+	return mLinkedPortals;
+}
+
+uint64_t
+PortalGraph::GetPlacementVersion() const
+{
+	return mPlacementVersion;
+}
+
+void
+PortalGraph::Rebuild()
+{
+	mPlacedPortals.clear();
+	mLinkedPortals.clear();
+	for( auto& portal : mPortals )
+	{
+		if( !portal->HasBeenPlaced() )
+		{
+			continue;
+		}
+		mPlacedPortals.push_back( portal.get() );
+		if( portal->IsLinkActive() )
+		{
+			mLinkedPortals.push_back( portal.get() );
+		}
+	}
+	mIsDirty = false;
+}
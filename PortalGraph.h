@@ -0,0 +1,70 @@
+#ifndef _PORTAL_GRAPH_H
+#define _PORTAL_GRAPH_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace portal
+{
+	class Portal;
+
+	///
+	/// 关卡里所有的传送门
+	/// 每个传送门是一个节点，配对关系是边：第2 * i和2 * i + 1个传送门是第i对。
+	/// 放置和移除时传送门会通知这里，下面的列表只在放置之后重新整理，
+	/// 每帧的更新、克隆和渲染只遍历放置了的传送门，没放置的传送门对不增加每帧的开销
+	///
+	class PortalGraph
+	{
+	public:
+		PortalGraph();
+		~PortalGraph();
+
+		PortalGraph( const PortalGraph& ) = delete;
+		PortalGraph& operator=( const PortalGraph& ) = delete;
+
+		///
+		/// 添加一对传送门，两个传送门会互相配对
+		///
+		/// @return
+		///		传送门对的序号，两个传送门的序号是2 * pair和2 * pair + 1
+		///
+		int AddPair( std::unique_ptr<Portal> portal_a, std::unique_ptr<Portal> portal_b );
+
+		int GetNumPortals() const;
+		int GetNumPairs() const;
+
+		///
+		/// @return
+		///		序号超出范围时返回nullptr
+		///
+		Portal* GetPortal( int index ) const;
+
+		///
+		/// 已经放置的传送门，包括配对的还没放置的，每次物理模拟之后要调用它们的Update()
+		///
+		const std::vector<Portal*>& GetPlacedPortals();
+
+		///
+		/// 两端都已经放置的传送门，物体可以穿过，也要渲染门里的内容
+		///
+		const std::vector<Portal*>& GetLinkedPortals();
+
+		///
+		/// 每次有传送门放置、移动或者移除时加一，用来判断PortalSpatialHash是否需要重建
+		///
+		uint64_t GetPlacementVersion() const;
+
+	private:
+		void Rebuild();
+
+		std::vector<std::unique_ptr<Portal>> mPortals;
+		std::vector<Portal*> mPlacedPortals;
+		std::vector<Portal*> mLinkedPortals;
+		bool mIsDirty; ///< 有传送门放置或者移除过，列表要重新整理
+		uint64_t mPlacementVersion;
+	};
+}
+
+#endif
@@ -0,0 +1,167 @@
+#include "PortalSpatialHash.h"
+
+#include <algorithm>
+#include <cmath>
+#include <glm/common.hpp>
+
+#include "Portal.h"
+#include "Portalable.h"
+#include "Profiler.h"
+
+using namespace portal;
+
+namespace
+{
+	// 物体中心到表面的最大距离，物体的中心在触发区外面时身体可能已经进去了
+	const float PORTALABLE_MARGIN = 10.f;
+	// 物体一步扫过的格子超过这个数时不再逐个查，直接当作所有传送门都在附近
+	const int MAX_SWEPT_CELLS = 64;
+
+	constexpr int CELL_BITS = 21;
+	constexpr uint64_t CELL_MASK = ( 1ull << CELL_BITS ) - 1;
+}
+
+PortalSpatialHash::PortalSpatialHash( float cell_size )
+	: mCellSize( std::max( cell_size, 1.f ) )
+	, mIsRebuilt( false )
+{}
+
+PortalSpatialHash::~PortalSpatialHash()
+{}
+
+void
+PortalSpatialHash::AddPortalable( Portalable* portalable )
+{
+	if( portalable && std::find( mPortalables.begin(), mPortalables.end(), portalable ) == mPortalables.end() )
+	{
+		mPortalables.push_back( portalable );
+	}
+}
+
+void
+PortalSpatialHash::RemovePortalable( Portalable* portalable )
+{
+	auto itr = std::find( mPortalables.begin(), mPortalables.end(), portalable );
+	if( itr != mPortalables.end() )
+	{
+		( *itr )->mNearbyPortals.clear();
+		*itr = mPortalables.back();
+		mPortalables.pop_back();
+	}
+}
+
+void
+PortalSpatialHash::Rebuild( const std::vector<Portal*>& portals )
+{
+	PORTAL_PROFILE_SCOPE( "PortalSpatialHash::Rebuild" );
+	mPortals = portals;
+	mCells.clear();
+	for( Portal* portal : mPortals )
+	{
+		const physics::AABB aabb = portal->GetTriggerAABB();
+		const glm::ivec3 min_cell = GetCell( aabb.min - glm::vec3{ PORTALABLE_MARGIN } );
+		const glm::ivec3 max_cell = GetCell( aabb.max + glm::vec3{ PORTALABLE_MARGIN } );
+		for( int x = min_cell.x; x <= max_cell.x; x++ )
+		{
+			for( int y = min_cell.y; y <= max_cell.y; y++ )
+			{
+				for( int z = min_cell.z; z <= max_cell.z; z++ )
+				{
+					mCells[ GetCellKey( x, y, z ) ].push_back( portal );
+				}
+			}
+		}
+	}
+	mIsRebuilt = true;
+}
+
+void
+PortalSpatialHash::Update()
+{
+	PORTAL_PROFILE_SCOPE( "PortalSpatialHash::Update" );
+	for( Portalable* portalable : mPortalables )
+	{
+		auto physics_object = portalable->GetPhysicsObject();
+		// 不在物理世界里或者关闭了传送门检测的物体
+		if( !physics_object || !physics_object->IsSimulated() ||
+			Portalable::FromCollisionObject( physics_object->GetCollisionObject() ) != portalable )
+		{
+			portalable->mNearbyPortals.clear();
+			continue;
+		}
+		if( !physics_object->IsActive() && !mIsRebuilt )
+		{
+			continue;
+		}
+
+		auto& nearby = portalable->mNearbyPortals;
+		nearby.clear();
+		if( mCells.empty() )
+		{
+			continue;
+		}
+
+		// 这一步扫过的线段的包围盒
+		const glm::vec3 from = physics_object->GetPreviousPosition();
+		const glm::vec3 to = physics_object->GetPosition();
+		const glm::ivec3 min_cell = GetCell( glm::min( from, to ) );
+		const glm::ivec3 max_cell = GetCell( glm::max( from, to ) );
+		const glm::ivec3 num_cells = max_cell - min_cell + glm::ivec3{ 1 };
+		if( num_cells.x * num_cells.y * num_cells.z > MAX_SWEPT_CELLS )
+		{
+			nearby = mPortals;
+		}
+		else
+		{
+			for( int x = min_cell.x; x <= max_cell.x; x++ )
+			{
+				for( int y = min_cell.y; y <= max_cell.y; y++ )
+				{
+					for( int z = min_cell.z; z <= max_cell.z; z++ )
+					{
+						auto cell = mCells.find( GetCellKey( x, y, z ) );
+						if( cell == mCells.end() )
+						{
+							continue;
+						}
+						for( Portal* portal : cell->second )
+						{
+							if( std::find( nearby.begin(), nearby.end(), portal ) == nearby.end() )
+							{
+								nearby.push_back( portal );
+							}
+						}
+					}
+				}
+			}
+		}
+
+		for( Portal* portal : nearby )
+		{
+			portal->AddNearbyPortalable( portalable );
+		}
+	}
+	mIsRebuilt = false;
+}
+
+int
+PortalSpatialHash::GetNumCells() const
+{
+	return static_cast<int>( mCells.size() );
+}
+
+glm::ivec3
+PortalSpatialHash::GetCell( const glm::vec3& point ) const
+{
+	return glm::ivec3{ glm::floor( point / mCellSize ) };
+}
+
+/*static*/
+PortalSpatialHash::CellKey
+PortalSpatialHash::GetCellKey( int x, int y, int z )
+{
+	// 每个坐标取低21位，格子边长32时可以表示上千万单位的范围
+	return ( ( static_cast<uint64_t>( x ) & CELL_MASK ) << ( 2 * CELL_BITS ) )
+		 | ( ( static_cast<uint64_t>( y ) & CELL_MASK ) << CELL_BITS )
+		 | ( static_cast<uint64_t>( z ) & CELL_MASK );
+}
@@ -0,0 +1,72 @@
+#ifndef _PORTAL_SPATIAL_HASH_H
+#define _PORTAL_SPATIAL_HASH_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <glm/vec3.hpp>
+
+namespace portal
+{
+	class Portal;
+	class Portalable;
+
+	///
+	/// 能穿过传送门的物体的登记表，以及按均匀网格划分的传送门触发区
+	/// 每个传送门的触发区按包围盒放进它覆盖的所有格子（哈希表里只有非空的格子），
+	/// 每次物理模拟之后，物体这一步扫过的格子里的传送门就是它附近的传送门（见Portalable::GetNearbyPortals()），
+	/// 传送门也会收到这些物体（见Portal::AddNearbyPortalable()）。
+	/// 这样每个物体只和附近格子里的传送门比较，不用和所有传送门比较
+	///
+	class PortalSpatialHash
+	{
+	public:
+		///
+		/// 构造函数
+		///
+		/// @param cell_size
+		///		格子的边长，比传送门的触发区大一些比较合适
+		///
+		explicit PortalSpatialHash( float cell_size );
+		~PortalSpatialHash();
+
+		PortalSpatialHash( const PortalSpatialHash& ) = delete;
+		PortalSpatialHash& operator=( const PortalSpatialHash& ) = delete;
+
+		///
+		/// 登记/移除物体，物体销毁之前必须移除（或者先销毁整个PortalSpatialHash）
+		///
+		void AddPortalable( Portalable* portalable );
+		void RemovePortalable( Portalable* portalable );
+
+		///
+		/// 重新把传送门放进格子里，传送门放置、移动或者被移除之后调用
+		///
+		/// @param portals
+		///		已经放置的传送门
+		///
+		void Rebuild( const std::vector<Portal*>& portals );
+
+		///
+		/// 每次物理模拟之后、传送门Update()之前调用，更新每个物体附近的传送门
+		/// 睡眠的物体不会动，保留上次的结果
+		///
+		void Update();
+
+		int GetNumCells() const;
+
+	private:
+		using CellKey = uint64_t;
+
+		glm::ivec3 GetCell( const glm::vec3& point ) const;
+		static CellKey GetCellKey( int x, int y, int z );
+
+		float mCellSize;
+		std::vector<Portalable*> mPortalables;
+		std::vector<Portal*> mPortals;                             ///< Rebuild()时放置了的传送门，物体一步扫过太多格子时直接用它
+		std::unordered_map<CellKey, std::vector<Portal*>> mCells;
+		bool mIsRebuilt;                                           ///< Rebuild()之后睡眠的物体也要重新查一次
+	};
+}
+
+#endif
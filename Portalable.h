@@ -1,11 +1,14 @@
 #ifndef _PORTALABLE_H
 #define _PORTALABLE_H
 
+#include <vector>
+
 #include "Physics.h"
 
 namespace portal
 {
 	class Portal;
+	class PortalSpatialHash;
 
 	class Portalable
 	{
@@ -20,8 +23,49 @@ namespace portal
 			return mPortalablePO;
 		}
 
+		///
+		/// 从碰撞体找到对应的Portalable，传送门的触发区用它把重叠列表里的物体还原出来
+		/// 
+		static Portalable* FromCollisionObject( const btCollisionObject* obj )
+		{
+			return obj ? static_cast<Portalable*>( obj->getUserPointer() ) : nullptr;
+		}
+
+		///
+		/// 附近的传送门，由PortalSpatialHash每次物理模拟之后更新，没有登记的物体总是空的
+		/// 
+		const std::vector<Portal*>& GetNearbyPortals() const
+		{
+			return mNearbyPortals;
+		}
+
+		///
+		/// 关闭后传送门的触发区会忽略这个物体
+		/// 
+		void SetPortalDetectionEnabled( bool enabled )
+		{
+			if( mPortalablePO )
+			{
+				mPortalablePO->GetCollisionObject()->setUserPointer( enabled ? this : nullptr );
+			}
+		}
+
 	protected:
+		///
+		/// 设置用来穿越传送门的碰撞体，同时让传送门的触发区能认出它
+		/// 
+		void SetPortalableObject( physics::Physics::PhysicsObject* physics_object )
+		{
+			mPortalablePO = physics_object;
+			SetPortalDetectionEnabled( true );
+		}
+
 		physics::Physics::PhysicsObject* mPortalablePO = nullptr;
+
+	private:
+		friend class PortalSpatialHash;
+
+		std::vector<Portal*> mNearbyPortals;
 	};
 }
 
@@ -0,0 +1,235 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <rapidjson/ostreamwrapper.h>
+#include <rapidjson/writer.h>
+
+using namespace portal;
+
+namespace
+{
+	constexpr size_t THREAD_BUFFER_CAPACITY = 1 << 16; // 必须是2的幂
+
+	struct Event
+	{
+		const char* name;
+		int64_t begin_ns;
+		int64_t end_ns;
+		int arg;
+	};
+
+	///
+	/// 每个线程独占的环形缓存
+	/// 只有拥有者线程会写入，mHead用release/acquire保证导出线程看到完整的标记
+	///
+	class ThreadBuffer
+	{
+	public:
+		ThreadBuffer( int thread_id )
+			: mThreadId( thread_id )
+			, mThreadName( nullptr )
+			, mEvents( THREAD_BUFFER_CAPACITY )
+			, mHead( 0 )
+		{}
+
+		void Push( const Event& event )
+		{
+			const uint64_t head = mHead.load( std::memory_order_relaxed );
+			mEvents[ head & ( THREAD_BUFFER_CAPACITY - 1 ) ] = event;
+			mHead.store( head + 1, std::memory_order_release );
+		}
+
+		///
+		/// 复制出当前所有有效的标记
+		///
+		void Snapshot( std::vector<Event>& out ) const
+		{
+			const uint64_t head = mHead.load( std::memory_order_acquire );
+			const uint64_t tail = head > THREAD_BUFFER_CAPACITY ? head - THREAD_BUFFER_CAPACITY : 0;
+			const size_t first = out.size();
+			for( uint64_t i = tail; i < head; i++ )
+			{
+				out.push_back( mEvents[ i & ( THREAD_BUFFER_CAPACITY - 1 ) ] );
+			}
+			// 复制期间拥有者线程可能已经覆盖了最老的几个标记，丢掉它们
+			const uint64_t new_head = mHead.load( std::memory_order_acquire );
+			const uint64_t new_tail = new_head > THREAD_BUFFER_CAPACITY ? new_head - THREAD_BUFFER_CAPACITY : 0;
+			if( new_tail > tail )
+			{
+				const size_t overwritten = static_cast<size_t>( std::min( new_tail - tail, head - tail ) );
+				out.erase( out.begin() + first, out.begin() + first + overwritten );
+			}
+		}
+
+		int GetThreadId() const
+		{
+			return mThreadId;
+		}
+
+		void SetThreadName( const char* name )
+		{
+			mThreadName.store( name, std::memory_order_release );
+		}
+
+		const char* GetThreadName() const
+		{
+			return mThreadName.load( std::memory_order_acquire );
+		}
+
+	private:
+		int mThreadId;
+		std::atomic<const char*> mThreadName;
+		std::vector<Event> mEvents;
+		std::atomic<uint64_t> mHead;
+	};
+
+	///
+	/// 所有线程缓存的登记表，只有线程第一次记录时需要加锁
+	///
+	struct Registry
+	{
+		std::mutex mutex;
+		std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+		std::atomic<bool> enabled{ false };
+		const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+	};
+
+	Registry&
+	get_registry()
+	{
+		static Registry registry;
+		return registry;
+	}
+
+	ThreadBuffer&
+	get_thread_buffer()
+	{
+		thread_local ThreadBuffer* buffer = nullptr;
+		if( !buffer )
+		{
+			Registry& registry = get_registry();
+			std::lock_guard<std::mutex> lock( registry.mutex );
+			const int thread_id = static_cast<int>( registry.buffers.size() ) + 1;
+			registry.buffers.emplace_back( std::make_unique<ThreadBuffer>( thread_id ) );
+			buffer = registry.buffers.back().get();
+		}
+		return *buffer;
+	}
+}
+
+void
+profiler::SetEnabled( bool enabled )
+{
+	get_registry().enabled.store( enabled, std::memory_order_relaxed );
+}
+
+bool
+profiler::IsEnabled()
+{
+	return get_registry().enabled.load( std::memory_order_relaxed );
+}
+
+void
+profiler::SetThreadName( const char* name )
+{
+	get_thread_buffer().SetThreadName( name );
+}
+
+int64_t
+profiler::Now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - get_registry().epoch ).count();
+}
+
+void
+profiler::Record( const char* name, int64_t begin_ns, int64_t end_ns, int arg )
+{
+	get_thread_buffer().Push( { name, begin_ns, end_ns, arg } );
+}
+
+void
+profiler::WriteChromeTrace( std::ostream& os )
+{
+	// 只在复制缓存指针时加锁，复制标记本身不影响正在记录的线程
+	std::vector<ThreadBuffer*> buffers;
+	{
+		Registry& registry = get_registry();
+		std::lock_guard<std::mutex> lock( registry.mutex );
+		for( auto& buffer : registry.buffers )
+		{
+			buffers.push_back( buffer.get() );
+		}
+	}
+
+	rapidjson::OStreamWrapper osw{ os };
+	rapidjson::Writer<rapidjson::OStreamWrapper> writer{ osw };
+	writer.StartObject();
+	writer.Key( "displayTimeUnit" );
+	writer.String( "ms" );
+	writer.Key( "traceEvents" );
+	writer.StartArray();
+
+	std::vector<Event> events;
+	for( auto buffer : buffers )
+	{
+		if( auto thread_name = buffer->GetThreadName() )
+		{
+			writer.StartObject();
+			writer.Key( "name" ); writer.String( "thread_name" );
+			writer.Key( "ph" ); writer.String( "M" );
+			writer.Key( "pid" ); writer.Int( 1 );
+			writer.Key( "tid" ); writer.Int( buffer->GetThreadId() );
+			writer.Key( "args" );
+			writer.StartObject();
+			writer.Key( "name" ); writer.String( thread_name );
+			writer.EndObject();
+			writer.EndObject();
+		}
+
+		events.clear();
+		buffer->Snapshot( events );
+		for( auto& event : events )
+		{
+			writer.StartObject();
+			writer.Key( "name" ); writer.String( event.name );
+			writer.Key( "ph" ); writer.String( "X" );
+			writer.Key( "ts" ); writer.Double( event.begin_ns / 1000.0 );
+			writer.Key( "dur" ); writer.Double( ( event.end_ns - event.begin_ns ) / 1000.0 );
+			writer.Key( "pid" ); writer.Int( 1 );
+			writer.Key( "tid" ); writer.Int( buffer->GetThreadId() );
+			if( event.arg >= 0 )
+			{
+				writer.Key( "args" );
+				writer.StartObject();
+				writer.Key( "level" ); writer.Int( event.arg );
+				writer.EndObject();
+			}
+			writer.EndObject();
+		}
+	}
+
+	writer.EndArray();
+	writer.EndObject();
+}
+
+bool
+profiler::SaveChromeTrace( const std::string& path )
+{
+	std::ofstream ofs{ path };
+	if( !ofs.is_open() )
+	{
+		std::cerr << "ERROR: Failed to open trace file " << path << std::endl;
+		return false;
+	}
+	WriteChromeTrace( ofs );
+	return true;
+}
@@ -0,0 +1,97 @@
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include <string>
+#include <ostream>
+#include <cstdint>
+
+namespace portal
+{
+	///
+	/// 轻量CPU性能分析器
+	/// 每个线程第一次记录时会分配自己的环形缓存，之后记录标记不需要加锁。
+	/// 结果可以导出为Chrome trace JSON（chrome://tracing 或 Perfetto 打开）。
+	///
+	/// 用法：
+	///		PORTAL_PROFILE_SCOPE( "Physics::Update" );
+	///		PORTAL_PROFILE_SCOPE_ARG( "RenderPortals", current_recursion_level );
+	///
+	namespace profiler
+	{
+		///
+		/// 开启/关闭记录，关闭时标记几乎没有开销
+		///
+		void SetEnabled( bool enabled );
+		bool IsEnabled();
+
+		///
+		/// 设置当前线程在trace里显示的名字
+		///
+		/// @param name
+		///		必须是静态字符串
+		///
+		void SetThreadName( const char* name );
+
+		///
+		/// 当前时间，单位纳秒，从分析器初始化开始计
+		///
+		int64_t Now();
+
+		///
+		/// 记录一个已完成的标记
+		///
+		/// @param name
+		///		标记名字，必须是静态字符串
+		///
+		/// @param begin_ns, end_ns
+		///		起止时间，由Now()获取
+		///
+		/// @param arg
+		///		附加参数（比如传送门递归层数），-1表示没有
+		///
+		void Record( const char* name, int64_t begin_ns, int64_t end_ns, int arg = -1 );
+
+		///
+		/// 导出Chrome trace JSON
+		/// 可以在其他线程仍在记录时调用，正在被覆盖的旧标记会被丢弃
+		///
+		void WriteChromeTrace( std::ostream& os );
+		bool SaveChromeTrace( const std::string& path );
+
+		///
+		/// RAII标记，构造时开始计时，析构时记录
+		///
+		class ScopedMarker
+		{
+		public:
+			ScopedMarker( const char* name, int arg = -1 )
+				: mName( IsEnabled() ? name : nullptr )
+				, mArg( arg )
+				, mBegin( mName ? Now() : 0 )
+			{}
+
+			~ScopedMarker()
+			{
+				if( mName )
+				{
+					Record( mName, mBegin, Now(), mArg );
+				}
+			}
+
+			ScopedMarker( const ScopedMarker& ) = delete;
+			ScopedMarker& operator=( const ScopedMarker& ) = delete;
+
+		private:
+			const char* mName;
+			int mArg;
+			int64_t mBegin;
+		};
+	}
+}
+
+#define PORTAL_PROFILE_CONCAT_IMPL( a, b ) a##b
+#define PORTAL_PROFILE_CONCAT( a, b ) PORTAL_PROFILE_CONCAT_IMPL( a, b )
+#define PORTAL_PROFILE_SCOPE( name ) ::portal::profiler::ScopedMarker PORTAL_PROFILE_CONCAT( profile_marker_, __LINE__ )( name )
+#define PORTAL_PROFILE_SCOPE_ARG( name, arg ) ::portal::profiler::ScopedMarker PORTAL_PROFILE_CONCAT( profile_marker_, __LINE__ )( name, arg )
+
+#endif
@@ -13,6 +13,7 @@
 
 #include "Camera.h"
 #include "BuiltInShaders.h"
+#include "GpuProfiler.h"
 
 using namespace portal;
 
@@ -25,6 +26,7 @@ namespace
 	constexpr GLuint COLOR_INDEX = 1;
 	constexpr GLuint UV_INDEX = 2;
 	constexpr GLuint NORMAL_INDEX = 3;
+	constexpr GLuint INSTANCE_MODEL_MATRIX_INDEX = 4; // mat4占用4个位置：4-7
 
 	int get_gl_draw_mode( Renderer::Renderable::DrawType type )
 	{
@@ -46,6 +48,7 @@ const std::string Renderer::DEFAULT_SKYBOX_SHADER = "DEFAULT_SKYBOX_SHADER";
 const std::string Renderer::DEBUG_PHYSICS_SHADER = "DEBUG_PHYSICS_SHADER";
 const std::string Renderer::PORTAL_HOLE_SHADER = "PORTAL_HOLE_SHADER";
 const std::string Renderer::PORTAL_FRAME_SHADER = "PORTAL_FRAME_SHADER";
+const std::string Renderer::INSTANCED_SHADER = "INSTANCED_SHADER";
 
 ///
 /// Shader implementaitons
@@ -164,7 +167,8 @@ Renderer::Shader::SetMat4( int location, const glm::mat4& matrix )
 Renderer::Renderable::Renderable( std::vector<Vertex>&& vertices, std::string shader_name, TextureInfo* texture_id, DrawType draw_type )
 	: mVBO( 0 )
 	, mVAO( 0 )
-	, mNumberOfVertices( static_cast<int>( vertices.size() ) )
+	, mVertices( std::move( vertices ) )
+	, mNumberOfVertices( static_cast<int>( mVertices.size() ) )
 	, mShader( shader_name )
 	, mTexture( texture_id )
 	, mDrawType( draw_type )
@@ -172,6 +176,21 @@ Renderer::Renderable::Renderable( std::vector<Vertex>&& vertices, std::string sh
 	, mRotation( 0.f )
 	, mTransform( 1.f )
 	, mIsDirty( false )
+{
+}
+
+Renderer::Renderable::~Renderable()
+{
+	// 从来没画过的物体没有显存，也可能根本没有OpenGL context
+	if( mVAO )
+	{
+		glDeleteBuffers( 1, &mVBO );
+		glDeleteVertexArrays( 1, &mVAO );
+	}
+}
+
+void
+Renderer::Renderable::Upload()
 {
 	glGenVertexArrays( 1, &mVAO );
 	glGenBuffers( 1, &mVBO ); 
@@ -179,7 +198,7 @@ Renderer::Renderable::Renderable( std::vector<Vertex>&& vertices, std::string sh
 	glBindVertexArray( mVAO );
 	glBindBuffer( GL_ARRAY_BUFFER, mVBO );
 	// 申请显存空间来放顶点数据
-	glBufferData( GL_ARRAY_BUFFER, mNumberOfVertices * sizeof( Vertex ), &vertices.front(), GL_STATIC_DRAW );
+	glBufferData( GL_ARRAY_BUFFER, mNumberOfVertices * sizeof( Vertex ), mVertices.data(), GL_STATIC_DRAW );
 	// 绑定顶点位置数据到 POSITION_INDEX
 	glVertexAttribPointer( POSITION_INDEX, 3, GL_FLOAT, GL_FALSE, sizeof( Vertex ), (void*)0 );
 	glEnableVertexAttribArray( POSITION_INDEX );
@@ -192,17 +211,18 @@ Renderer::Renderable::Renderable( std::vector<Vertex>&& vertices, std::string sh
 	// 绑定顶点法线数据到 NORMAL_INDEX
 	glVertexAttribPointer( NORMAL_INDEX, 3, GL_FLOAT, GL_FALSE, sizeof( Vertex ), (void*)( sizeof( glm::vec3 ) + sizeof( glm::vec4 ) + sizeof( glm::vec2 ) ) );
 	glEnableVertexAttribArray( NORMAL_INDEX );
-}
 
-Renderer::Renderable::~Renderable()
-{
-	glDeleteBuffers( 1, &mVBO );
-	glDeleteVertexArrays( 1, &mVAO );
+	// 顶点已经在显存里了
+	std::vector<Vertex>().swap( mVertices );
 }
 
 unsigned int
-Renderer::Renderable::GetVAO() const
+Renderer::Renderable::GetVAO()
 {
+	if( !mVAO )
+	{
+		Upload();
+	}
 	return mVAO;
 }
 
@@ -397,8 +417,12 @@ Renderer::Renderer()
 	: mProjectionMatrix( glm::mat4( 1.f ) )
 	, mViewMatrix( glm::mat4( 1.f ) )
 	, mViewportSize( { 0, 0 } )
+	, mDrawCallCount( 0 )
+	, mInstanceVBO( 0 )
+	, mInstanceVBOCapacity( 0 )
 {
 	mResources = std::make_unique<Resources>();
+	mGpuProfiler = std::make_unique<GpuProfiler>();
 
 	glEnable( GL_DEPTH_TEST );
 	glEnable( GL_CULL_FACE );
@@ -429,10 +453,17 @@ Renderer::Renderer()
 	{
 		std::cerr << "ERROR: Failed to compile default shaders." << std::endl;
 	}
+	if( !mResources->CompileShader( INSTANCED_SHADER, INSTANCED_VERTEX_SHADER, DEFAULT_FRAGMENT_SHADER ) )
+	{
+		std::cerr << "ERROR: Failed to compile instanced shader." << std::endl;
+	}
+
+	glGenBuffers( 1, &mInstanceVBO );
 }
 
 Renderer::~Renderer()
 {
+	glDeleteBuffers( 1, &mInstanceVBO );
 }
 
 void 
@@ -470,6 +501,51 @@ Renderer::RenderOneoff( Renderable* renderable_obj )
 		get_gl_draw_mode( renderable_obj->GetDrawType() ), 
 		0, 
 		renderable_obj->GetNumberOfVertices() );
+	mDrawCallCount++;
+}
+
+void
+Renderer::RenderInstanced( Renderable* renderable_obj, const std::vector<glm::mat4>& transforms )
+{
+	if( !renderable_obj || transforms.empty() )
+	{
+		return;
+	}
+	if( auto tex_ptr = renderable_obj->GetTexture() )
+	{
+		glBindTexture( tex_ptr->tex_type, tex_ptr->texture_id );
+	}
+	auto shader = mResources->GetShader( INSTANCED_SHADER );
+	glUseProgram( shader.GetId() );
+	shader.SetViewMatrix( mViewMatrix );
+	shader.SetProjectionMatrix( mProjectionMatrix );
+
+	// 先绑定模型的VAO，第一次绘制时它会上传顶点，改变GL_ARRAY_BUFFER的绑定
+	glBindVertexArray( renderable_obj->GetVAO() );
+
+	// 上传这次的实例矩阵，放不下时才重新申请显存
+	glBindBuffer( GL_ARRAY_BUFFER, mInstanceVBO );
+	if( transforms.size() > mInstanceVBOCapacity )
+	{
+		mInstanceVBOCapacity = transforms.size();
+		glBufferData( GL_ARRAY_BUFFER, mInstanceVBOCapacity * sizeof( glm::mat4 ), nullptr, GL_STREAM_DRAW );
+	}
+	glBufferSubData( GL_ARRAY_BUFFER, 0, transforms.size() * sizeof( glm::mat4 ), glm::value_ptr( transforms.front() ) );
+
+	// 把实例矩阵绑定到模型的VAO上，每个实例前进一个矩阵
+	for( GLuint column = 0; column < 4; column++ )
+	{
+		const GLuint index = INSTANCE_MODEL_MATRIX_INDEX + column;
+		glVertexAttribPointer( index, 4, GL_FLOAT, GL_FALSE, sizeof( glm::mat4 ), (void*)( column * sizeof( glm::vec4 ) ) );
+		glEnableVertexAttribArray( index );
+		glVertexAttribDivisor( index, 1 );
+	}
+	glDrawArraysInstanced(
+		get_gl_draw_mode( renderable_obj->GetDrawType() ),
+		0,
+		renderable_obj->GetNumberOfVertices(),
+		static_cast<GLsizei>( transforms.size() ) );
+	mDrawCallCount++;
 }
 
 void 
@@ -491,8 +567,26 @@ Renderer::SetProjectionMatrix( glm::mat4 projection )
 	mProjectionMatrix = std::move( projection );
 }
 
+unsigned int
+Renderer::GetDrawCallCount() const
+{
+	return mDrawCallCount;
+}
+
+void
+Renderer::ResetDrawCallCount()
+{
+	mDrawCallCount = 0;
+}
+
 Renderer::Resources&
 Renderer::GetResources()
 {
 	return *mResources.get();
 }
+
+GpuProfiler&
+Renderer::GetGpuProfiler()
+{
+	return *mGpuProfiler.get();
+}
\ No newline at end of file
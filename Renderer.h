@@ -12,6 +12,7 @@
 namespace portal
 {
 	class Camera;
+	class GpuProfiler;
 
 	struct Vertex
 	{
@@ -39,6 +40,7 @@ namespace portal
 		static const std::string DEFAULT_SKYBOX_SHADER;
 		static const std::string PORTAL_HOLE_SHADER;
 		static const std::string PORTAL_FRAME_SHADER;
+		static const std::string INSTANCED_SHADER;
 
 		///
 		/// Shader类
@@ -125,6 +127,7 @@ namespace portal
 		///
 		/// 可渲染对象
 		/// 包括了它用到的Shader id, texture id, 缓存id
+		/// 顶点在第一次绘制时才上传到显存，所以没有OpenGL context时也可以创建（无头模式）
 		/// 
 		class Renderable
 		{
@@ -162,12 +165,12 @@ namespace portal
 			~Renderable();
 
 			///
-			/// 获取VAO Id
+			/// 获取VAO Id，第一次调用时创建VAO并上传顶点
 			/// 
 			/// @return unsigned int
 			///		OpenGL VAO id
 			/// 
-			unsigned int GetVAO() const;
+			unsigned int GetVAO();
 
 			///
 			/// 获取顶点数量
@@ -204,8 +207,11 @@ namespace portal
 			glm::mat4 GetTransform();
 
 		private:
+			void Upload();
+
 			unsigned int mVBO;
 			unsigned int mVAO;
+			std::vector<Vertex> mVertices; ///< 还没上传的顶点，上传后清空
 			int mNumberOfVertices;
 			std::string mShader;
 			TextureInfo* mTexture;
@@ -310,6 +316,18 @@ public:
 		/// 
 		void RenderOneoff( Renderable* renderable_obj );
 
+		///
+		/// 用一次draw call把同一个模型画在多个位置
+		/// 模型的shader会被忽略，使用INSTANCED_SHADER
+		/// 
+		/// @param renderable_obj
+		///		模型，它自己的变换矩阵不起作用
+		/// 
+		/// @param transforms
+		///		每个实例的模型矩阵
+		/// 
+		void RenderInstanced( Renderable* renderable_obj, const std::vector<glm::mat4>& transforms );
+
 		///
 		/// 将提供的摄像机作为之后渲染的摄像机
 		/// 
@@ -322,15 +340,30 @@ public:
 
 		void SetProjectionMatrix( glm::mat4 projection );
 
+		///
+		/// 自上次ResetDrawCallCount()以来的draw call数量
+		/// 
+		unsigned int GetDrawCallCount() const;
+		void ResetDrawCallCount();
+
 		Resources& GetResources();
 
+		///
+		/// GPU计时器，用于统计各个渲染段的GPU耗时
+		/// 
+		GpuProfiler& GetGpuProfiler();
+
 	private:
 		glm::mat4 mProjectionMatrix;
 		glm::mat4 mViewMatrix;
 
 		std::unique_ptr<Resources> mResources;
+		std::unique_ptr<GpuProfiler> mGpuProfiler;
 
 		glm::ivec2 mViewportSize;
+		unsigned int mDrawCallCount;
+		unsigned int mInstanceVBO;          ///< RenderInstanced()每个实例的模型矩阵
+		size_t mInstanceVBOCapacity;        ///< mInstanceVBO能放多少个矩阵
 	};
 }
 
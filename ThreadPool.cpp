@@ -0,0 +1,123 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+using namespace portal;
+
+namespace
+{
+	thread_local bool tIsInParallelFor = false;
+}
+
+ThreadPool::ThreadPool( int num_threads )
+	: mJob( nullptr )
+	, mJobEnd( 0 )
+	, mGrainSize( 1 )
+	, mNextIndex( 0 )
+	, mBusyWorkers( 0 )
+	, mGeneration( 0 )
+	, mIsStopping( false )
+{
+	if( num_threads <= 0 )
+	{
+		num_threads = std::max( static_cast<int>( std::thread::hardware_concurrency() ), 1 );
+	}
+	// 调用ParallelFor()的线程也算一个
+	for( int i = 1; i < num_threads; i++ )
+	{
+		mWorkers.emplace_back( &ThreadPool::WorkerMain, this );
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		mIsStopping = true;
+	}
+	mWakeCondition.notify_all();
+	for( auto& worker : mWorkers )
+	{
+		worker.join();
+	}
+}
+
+int
+ThreadPool::GetNumThreads() const
+{
+	return static_cast<int>( mWorkers.size() ) + 1;
+}
+
+void
+ThreadPool::ParallelFor( int begin, int end, int grain_size, const std::function<void( int, int )>& body )
+{
+	grain_size = std::max( grain_size, 1 );
+	if( end - begin <= grain_size || mWorkers.empty() || tIsInParallelFor )
+	{
+		body( begin, end );
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		mJob = &body;
+		mJobEnd = end;
+		mGrainSize = grain_size;
+		mNextIndex.store( begin, std::memory_order_relaxed );
+		mBusyWorkers = static_cast<int>( mWorkers.size() );
+		mGeneration++;
+	}
+	mWakeCondition.notify_all();
+
+	tIsInParallelFor = true;
+	RunChunks();
+	tIsInParallelFor = false;
+
+	// body是调用者的引用，必须等所有线程都放手才能返回
+	std::unique_lock<std::mutex> lock( mMutex );
+	mDoneCondition.wait( lock, [this]() { return mBusyWorkers == 0; } );
+	mJob = nullptr;
+}
+
+void
+ThreadPool::WorkerMain()
+{
+	tIsInParallelFor = true;
+	uint64_t seen_generation = 0;
+	while( true )
+	{
+		{
+			std::unique_lock<std::mutex> lock( mMutex );
+			mWakeCondition.wait( lock, [&]() { return mIsStopping || mGeneration != seen_generation; } );
+			if( mIsStopping )
+			{
+				return;
+			}
+			seen_generation = mGeneration;
+		}
+
+		RunChunks();
+
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			if( --mBusyWorkers == 0 )
+			{
+				mDoneCondition.notify_one();
+			}
+		}
+	}
+}
+
+void
+ThreadPool::RunChunks()
+{
+	while( true )
+	{
+		const int chunk_begin = mNextIndex.fetch_add( mGrainSize, std::memory_order_relaxed );
+		if( chunk_begin >= mJobEnd )
+		{
+			return;
+		}
+		( *mJob )( chunk_begin, std::min( chunk_begin + mGrainSize, mJobEnd ) );
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace portal
+{
+	///
+	/// 简单的固定大小线程池
+	/// 只支持ParallelFor()：把一个区间切成小块分给所有线程，调用的线程自己也参与计算，全部完成后才返回。
+	/// 在ParallelFor()的任务里再调用ParallelFor()会直接在当前线程顺序执行。
+	///
+	class ThreadPool
+	{
+	public:
+		///
+		/// 构造函数
+		///
+		/// @param num_threads
+		///		参与计算的线程总数（包括调用ParallelFor()的线程），小于等于0时使用CPU核心数
+		///
+		explicit ThreadPool( int num_threads );
+		~ThreadPool();
+
+		ThreadPool( const ThreadPool& ) = delete;
+		ThreadPool& operator=( const ThreadPool& ) = delete;
+
+		int GetNumThreads() const;
+
+		///
+		/// 并行执行 body( chunk_begin, chunk_end )，覆盖[begin, end)
+		///
+		/// @param grain_size
+		///		每块的最小大小
+		///
+		void ParallelFor( int begin, int end, int grain_size, const std::function<void( int, int )>& body );
+
+	private:
+		void WorkerMain();
+
+		///
+		/// 不断领取并执行当前任务的小块，直到领完为止
+		///
+		void RunChunks();
+
+		std::vector<std::thread> mWorkers;
+		std::mutex mMutex;
+		std::condition_variable mWakeCondition;
+		std::condition_variable mDoneCondition;
+
+		// 当前任务，只在mMutex保护下修改
+		const std::function<void( int, int )>* mJob;
+		int mJobEnd;
+		int mGrainSize;
+		std::atomic<int> mNextIndex;
+		int mBusyWorkers;
+		uint64_t mGeneration;
+		bool mIsStopping;
+	};
+}
+
+#endif
@@ -32,6 +32,30 @@ portal::utility::extract_view_postion_from_matrix( const glm::mat4& view_matrix
 	return top / -denom;
 }
 
+bool
+portal::utility::is_sphere_in_frustum( const glm::mat4& view_projection, const glm::vec3& center, float radius )
+{
+	// glm是列主序，第i行是(m[0][i], m[1][i], m[2][i], m[3][i])
+	const glm::vec4 row_x( view_projection[0][0], view_projection[1][0], view_projection[2][0], view_projection[3][0] );
+	const glm::vec4 row_y( view_projection[0][1], view_projection[1][1], view_projection[2][1], view_projection[3][1] );
+	const glm::vec4 row_z( view_projection[0][2], view_projection[1][2], view_projection[2][2], view_projection[3][2] );
+	const glm::vec4 row_w( view_projection[0][3], view_projection[1][3], view_projection[2][3], view_projection[3][3] );
+	const glm::vec4 planes[] = {
+		row_w + row_x, row_w - row_x,
+		row_w + row_y, row_w - row_y,
+		row_w + row_z, row_w - row_z
+	};
+	for( auto& plane : planes )
+	{
+		const float length = glm::length( glm::vec3( plane ) );
+		if( glm::dot( glm::vec3( plane ), center ) + plane.w < -radius * length )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
 bool 
 portal::utility::is_vector_has_nan_value( const glm::vec3& vec )
 {
@@ -15,6 +15,14 @@ namespace portal
 
 		glm::vec3 extract_view_postion_from_matrix( const glm::mat4& view_matrix );
 
+		///
+		/// 球和视锥是否相交（保守判断，可能把视锥角落外的球也当作相交）
+		/// 
+		/// @param view_projection
+		///		投影矩阵 * 视图矩阵，视锥的六个面从这里取
+		/// 
+		bool is_sphere_in_frustum( const glm::mat4& view_projection, const glm::vec3& center, float radius );
+
 		bool is_vector_has_nan_value( const glm::vec3& vec );
 
 		glm::vec3 round_vector_to_zero( glm::vec3 vec, float threashold = 0.00015f );